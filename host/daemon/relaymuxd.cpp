@@ -0,0 +1,1159 @@
+// Daemon that shares relay mux units between many client processes.
+//
+// Usage: relaymuxd [-s socket] [-m metrics_file] [serial...]
+//
+// Units are opened by serial number, or all connected units without arguments.
+// Arguments starting with '/' are opened as serial ports, e.g. the device
+// emulator, and use the path as their serial number.
+// Clients connect to a Unix stream socket and send one request per line.
+// Exactly one reply line is returned for each request, in request order:
+//
+//   SCPI command       "OK", or the response if the line contains a query
+//   @DEVICE <serial>   Select unit for following SCPI lines, "OK"
+//   @DEVICE?           Serial number of the selected unit
+//   @LIST?             Serial numbers of all units, comma separated
+//   @LOCK 1[,2]        Lock mux groups of the selected unit, waits until free
+//   @UNLOCK [1[,2]]    Release mux group locks, all if none are listed
+//   @STATS?            requests,errors,depth,max_depth,min_us,mean_us,max_us
+//                      of the selected unit, once earlier requests completed
+//
+// Failed requests reply "ERR <code>,"<message>"", with the SCPI error code of
+// the unit where there is one. The first unit is selected by default.
+//
+// While a group is locked, relay commands of other clients that can switch
+// channels of that group fail with -221. Between BEGIN and COMMIT, DISCARD or
+// *RST of one client, relay commands of other clients to that unit wait, because
+// the unit has a single pending transaction.
+//
+// Requests that arrive together from all clients are written to each unit in
+// one batch. Metrics are kept per unit and, with -m, written every second in
+// Prometheus text format, e.g. for the node exporter textfile collector.
+//
+// On SIGTERM or SIGINT the socket is removed and requests already sent to a
+// unit are answered before exit, waiting at most 5 seconds. Requests that
+// were not sent yet reply "ERR -200,"Execution error;daemon shutting down"".
+
+#include "relaymux/relaymux.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace {
+
+const char *const DEFAULT_SOCKET = "/run/relaymux.sock";
+const size_t MAX_LINE = 4096;
+
+// Mux groups of the main board: 1 = channels 1-4, 2 = channels 5-8.
+// Channels of expansion boards are not part of any group.
+const int GROUP_COUNT = 2;
+const int GROUP_SIZE = 4;
+const uint32_t ALL_GROUPS = (1 << GROUP_COUNT) - 1;
+
+// epoll tags below the first client id
+const uint64_t TAG_LISTEN = 0;
+const uint64_t TAG_COMPLETION = 1;
+const uint64_t TAG_TIMER = 2;
+const uint64_t TAG_SIGNAL = 3;
+const uint64_t FIRST_CLIENT_ID = 16;
+
+using Clock = std::chrono::steady_clock;
+
+const std::chrono::milliseconds SHUTDOWN_TIMEOUT(5000);
+const char *const SHUTDOWN_ERROR = "ERR -200,\"Execution error;daemon shutting down\"";
+
+// Signals that stop the daemon, received through a signalfd
+sigset_t shutdown_signals()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    return signals;
+}
+
+struct Client;
+
+struct Unit {
+    relaymux::Device *device;
+    Client *locks[GROUP_COUNT] = {}; // Holder of each group lock
+    Client *transaction = nullptr;   // Client between BEGIN and COMMIT/DISCARD
+
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint32_t depth = 0; // Requests sent and not yet answered
+    uint32_t max_depth = 0;
+    uint64_t latency_min_us = UINT64_MAX;
+    uint64_t latency_max_us = 0;
+    uint64_t latency_sum_us = 0;
+};
+
+// Reply slot, filled in when its request completes
+struct Reply {
+    bool done = false;
+    std::string text;
+};
+
+struct Client {
+    uint64_t id;
+    int fd;
+    Unit *unit = nullptr;
+    std::string inbox;
+    std::string outbox;
+    std::deque<std::string> lines;              // Received, not yet started
+    std::deque<std::shared_ptr<Reply>> replies; // Started, in request order
+    bool eof = false;                           // Peer has shut down its side
+    uint32_t events = EPOLLIN;                  // Registered epoll events
+};
+
+// Reply from the device, passed from the client library thread
+struct Completion {
+    uint64_t client_id;
+    Unit *unit;
+    std::shared_ptr<Reply> reply;
+    Clock::time_point start;
+    std::string text;
+    bool error;
+};
+
+// What a line of SCPI commands does to relays
+struct Command {
+    bool query = false;
+    bool switches = false; // Can change relay states
+    uint32_t groups = 0;   // Mux groups it can switch
+    int transaction = 0;   // 1 if it leaves a transaction open, -1 if it ends one
+};
+
+std::string upper(std::string s)
+{
+    for (char &c : s)
+        c = std::toupper(static_cast<unsigned char>(c));
+    return s;
+}
+
+std::string trim(const std::string &s)
+{
+    size_t start = s.find_first_not_of(" \t\r");
+    if (start == std::string::npos)
+        return "";
+    return s.substr(start, s.find_last_not_of(" \t\r") - start + 1);
+}
+
+std::vector<std::string> split(const std::string &s, char sep)
+{
+    std::vector<std::string> result;
+    size_t start = 0, end;
+    while ((end = s.find(sep, start)) != std::string::npos)
+    {
+        result.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    result.push_back(s.substr(start));
+    return result;
+}
+
+// Node of an upper case header against a pattern node like "CLOSe",
+// which matches the short form CLOS and the long form CLOSE
+bool node_matches(const std::string &node, const char *pattern)
+{
+    std::string short_form;
+    for (const char *p = pattern; *p; p++)
+    {
+        if (!std::islower(static_cast<unsigned char>(*p)))
+            short_form += *p;
+    }
+    return node == short_form || node == upper(pattern);
+}
+
+bool header_matches(const std::vector<std::string> &nodes, const char *pattern)
+{
+    std::vector<std::string> parts = split(pattern, ':');
+    if (parts.size() != nodes.size())
+        return false;
+
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (!node_matches(nodes[i], parts[i].c_str()))
+            return false;
+    }
+    return true;
+}
+
+bool header_matches_any(const std::vector<std::string> &nodes, const std::vector<const char *> &patterns)
+{
+    for (const char *pattern : patterns)
+    {
+        if (header_matches(nodes, pattern))
+            return true;
+    }
+    return false;
+}
+
+// Linear channel number of a channel list entry, where cards 2 and up
+// are expansion boards that have no mux groups
+int parse_channel(const std::string &entry, bool &ok)
+{
+    size_t bang = entry.find('!');
+    char *end;
+    long value = std::strtol(entry.c_str() + (bang == std::string::npos ? 0 : bang + 1), &end, 10);
+    ok = ok && *end == '\0' && value > 0;
+
+    if (bang == std::string::npos)
+        return value;
+
+    long card = std::strtol(entry.c_str(), &end, 10);
+    ok = ok && end == entry.c_str() + bang && card > 0;
+    return (card == 1) ? value : GROUP_COUNT * GROUP_SIZE + 1;
+}
+
+// Mux groups of the channels in all "(@...)" lists of a parameter string.
+// Anything that does not parse, such as a route name, counts as all groups.
+uint32_t channel_groups(const std::string &params)
+{
+    uint32_t groups = 0;
+    size_t start = params.find("(@");
+    if (start == std::string::npos)
+        return ALL_GROUPS;
+
+    while (start != std::string::npos)
+    {
+        size_t end = params.find(')', start);
+        if (end == std::string::npos)
+            return ALL_GROUPS;
+
+        std::string list = params.substr(start + 2, end - start - 2);
+        for (const std::string &entry : split(list, ','))
+        {
+            std::string e = trim(entry);
+            if (e.empty())
+                continue;
+
+            std::vector<std::string> range = split(e, ':');
+            bool ok = range.size() <= 2;
+            int first = parse_channel(trim(range.front()), ok);
+            int last = parse_channel(trim(range.back()), ok);
+            if (!ok)
+                return ALL_GROUPS;
+            if (first > last)
+                std::swap(first, last);
+
+            for (int ch = first; ch <= last && ch <= GROUP_COUNT * GROUP_SIZE; ch++)
+                groups |= 1 << ((ch - 1) / GROUP_SIZE);
+        }
+
+        start = params.find("(@", end);
+    }
+    return groups;
+}
+
+Command classify(const std::string &line)
+{
+    static const std::vector<const char *> switching = {
+        "CLOSe", "OPEN", "OPEN:ALL", "SET", "SET:BBM", "SET:MBB", "MUX", "MUX:SELect",
+        "COMMit", "COMMit:BBM", "COMMit:MBB", "INITiate", "INITiate:IMMediate", "ABORt",
+        "*RCL", "*RST", "*TRG",
+    };
+    static const std::vector<const char *> with_list = {"CLOSe", "OPEN"};
+    static const std::vector<const char *> begin = {"BEGin"};
+    static const std::vector<const char *> end = {"COMMit", "COMMit:BBM", "COMMit:MBB", "DISCard", "*RST"};
+
+    Command result;
+    std::vector<std::string> path; // Header path for relative headers after ';'
+
+    for (const std::string &part : split(line, ';'))
+    {
+        std::string unit = trim(part);
+        if (unit.empty())
+            continue;
+
+        size_t space = unit.find_first_of(" \t");
+        std::string header = upper(unit.substr(0, space));
+        std::string params = (space == std::string::npos) ? "" : unit.substr(space + 1);
+
+        bool query = !header.empty() && header.back() == '?';
+        if (query)
+            header.pop_back();
+
+        std::vector<std::string> nodes;
+        if (header[0] == '*')
+        {
+            nodes = {header};
+        }
+        else
+        {
+            bool absolute = header[0] == ':';
+            nodes = split(absolute ? header.substr(1) : header, ':');
+            if (!absolute && !path.empty())
+                nodes.insert(nodes.begin(), path.begin(), path.end());
+            path.assign(nodes.begin(), nodes.end() - 1);
+        }
+
+        if (query)
+        {
+            result.query = true;
+            continue;
+        }
+
+        // ROUTe is optional in all relay commands
+        if (nodes.size() > 1 && node_matches(nodes[0], "ROUTe"))
+            nodes.erase(nodes.begin());
+
+        if (header_matches_any(nodes, switching))
+        {
+            result.switches = true;
+            result.groups |= header_matches_any(nodes, with_list) ? channel_groups(params) : ALL_GROUPS;
+        }
+
+        if (header_matches_any(nodes, begin))
+            result.transaction = 1;
+        else if (header_matches_any(nodes, end))
+            result.transaction = -1;
+    }
+
+    return result;
+}
+
+class Daemon {
+public:
+    Daemon(const std::string &socket_path, const std::string &metrics_path);
+    ~Daemon();
+
+    void open_units(const std::vector<std::string> &serials);
+    void run();
+
+private:
+    enum Start { STARTED, BLOCKED };
+
+    // Reset first thing in ~Daemon, while the completion queue that
+    // callbacks of requests failed by its destruction use still exists
+    std::unique_ptr<relaymux::Client> rm_;
+    std::map<std::string, std::unique_ptr<Unit>> units_; // By serial number
+    std::map<uint64_t, std::unique_ptr<Client>> clients_;
+    uint64_t next_id_ = FIRST_CLIENT_ID;
+
+    std::string socket_path_;
+    std::string metrics_path_;
+    int epfd_ = -1;
+    int listenfd_ = -1;
+    int completionfd_ = -1;
+    int timerfd_ = -1;
+    int signalfd_ = -1;
+    bool stopping_ = false;
+    Clock::time_point stop_deadline_;
+
+    std::mutex mutex_;
+    std::vector<Completion> completions_; // Guarded by mutex_
+
+    void add_fd(int fd, uint64_t tag);
+    void accept_clients();
+    void receive(Client &client);
+    void flush(Client &client);
+    void update_events(Client &client);
+    void drop(Client &client);
+    void handle_completions();
+    void write_metrics();
+    void stop();
+    bool replies_pending() const;
+    void abandon_replies();
+
+    bool pump(Client &client);
+    Start start(Client &client, const std::string &line);
+    Start daemon_command(Client &client, const std::string &line);
+    void submit(Client &client, const std::string &line, bool query);
+    void reply(Client &client, const std::string &text);
+    Unit *find_unit(const std::string &serial);
+};
+
+Daemon::Daemon(const std::string &socket_path, const std::string &metrics_path)
+    : rm_(new relaymux::Client()), socket_path_(socket_path), metrics_path_(metrics_path)
+{
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "epoll_create1");
+
+    completionfd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (completionfd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "eventfd");
+    add_fd(completionfd_, TAG_COMPLETION);
+
+    // The signals are blocked in all threads, see main()
+    sigset_t signals = shutdown_signals();
+    signalfd_ = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalfd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "signalfd");
+    add_fd(signalfd_, TAG_SIGNAL);
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error(socket_path + ": path too long");
+    std::strcpy(addr.sun_path, socket_path.c_str());
+
+    listenfd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenfd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "socket");
+
+    // Socket left over from a previous run
+    unlink(socket_path.c_str());
+    if (bind(listenfd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+        listen(listenfd_, 64) < 0)
+        throw std::system_error(errno, std::generic_category(), socket_path);
+    add_fd(listenfd_, TAG_LISTEN);
+
+    if (!metrics_path.empty())
+    {
+        timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerfd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "timerfd_create");
+
+        itimerspec interval = {};
+        interval.it_interval.tv_sec = 1;
+        interval.it_value.tv_sec = 1;
+        timerfd_settime(timerfd_, 0, &interval, nullptr);
+        add_fd(timerfd_, TAG_TIMER);
+    }
+}
+
+Daemon::~Daemon()
+{
+    while (!clients_.empty())
+        drop(*clients_.begin()->second);
+    rm_.reset();
+
+    if (listenfd_ >= 0)
+    {
+        ::close(listenfd_);
+        unlink(socket_path_.c_str());
+    }
+    if (timerfd_ >= 0)
+        ::close(timerfd_);
+    if (signalfd_ >= 0)
+        ::close(signalfd_);
+    if (completionfd_ >= 0)
+        ::close(completionfd_);
+    if (epfd_ >= 0)
+        ::close(epfd_);
+}
+
+void Daemon::add_fd(int fd, uint64_t tag)
+{
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = tag;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+        throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+}
+
+void Daemon::open_units(const std::vector<std::string> &serials)
+{
+    std::vector<relaymux::Device *> devices;
+    if (serials.empty())
+    {
+        devices = rm_->open_all();
+    }
+    else
+    {
+        for (const std::string &serial : serials)
+        {
+            if (serial[0] == '/')
+                devices.push_back(&rm_->open_path(serial, serial));
+            else
+                devices.push_back(&rm_->open(serial));
+        }
+    }
+
+    for (relaymux::Device *dev : devices)
+    {
+        auto unit = std::unique_ptr<Unit>(new Unit());
+        unit->device = dev;
+        units_[dev->serial()] = std::move(unit);
+    }
+}
+
+Unit *Daemon::find_unit(const std::string &serial)
+{
+    auto it = units_.find(serial);
+    return (it == units_.end()) ? nullptr : it->second.get();
+}
+
+void Daemon::run()
+{
+    epoll_event events[32];
+
+    while (!stopping_ || replies_pending())
+    {
+        int timeout = -1;
+        if (stopping_)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(stop_deadline_ - Clock::now());
+            if (left.count() <= 0)
+                break;
+            timeout = left.count();
+        }
+
+        int count = epoll_wait(epfd_, events, 32, timeout);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "epoll_wait");
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            uint64_t tag = events[i].data.u64;
+
+            if (tag == TAG_LISTEN)
+            {
+                accept_clients();
+            }
+            else if (tag == TAG_COMPLETION)
+            {
+                handle_completions();
+            }
+            else if (tag == TAG_TIMER)
+            {
+                uint64_t expirations;
+                if (::read(timerfd_, &expirations, sizeof(expirations)) > 0)
+                    write_metrics();
+            }
+            else if (tag == TAG_SIGNAL)
+            {
+                signalfd_siginfo info;
+                if (::read(signalfd_, &info, sizeof(info)) > 0)
+                    stop();
+            }
+            else
+            {
+                auto it = clients_.find(tag);
+                if (it == clients_.end())
+                    continue;
+
+                Client &client = *it->second;
+                if (events[i].events & EPOLLIN)
+                    receive(client);
+                if (client.fd >= 0 && (events[i].events & EPOLLOUT))
+                    flush(client);
+
+                // Fully closed, so nobody reads replies. Lines received
+                // before are still started.
+                if (client.fd >= 0 && (events[i].events & (EPOLLHUP | EPOLLERR)))
+                {
+                    receive(client);
+                    ::close(client.fd);
+                    client.fd = -1;
+                }
+            }
+        }
+
+        // Start requests of all clients in one batch. A request that ends a
+        // transaction or releases a lock can unblock clients pumped before it,
+        // and so can a client that is dropped.
+        bool progress = true;
+        while (progress)
+        {
+            {
+                relaymux::Client::Batch batch(*rm_);
+                while (progress)
+                {
+                    progress = false;
+                    for (auto &entry : clients_)
+                        progress |= pump(*entry.second);
+                }
+            }
+
+            // Close clients that are done, including those disconnected above
+            for (auto it = clients_.begin(); it != clients_.end();)
+            {
+                Client &client = *(it++)->second;
+                if (client.fd < 0 || (client.eof && client.lines.empty() && client.replies.empty() &&
+                                      client.outbox.empty()))
+                {
+                    drop(client);
+                    progress = true;
+                }
+            }
+        }
+    }
+
+    abandon_replies();
+}
+
+// Stop accepting clients and remove the socket. Requests already sent to
+// units are still answered, until replies_pending() or the deadline ends run().
+void Daemon::stop()
+{
+    if (stopping_)
+        return;
+
+    stopping_ = true;
+    stop_deadline_ = Clock::now() + SHUTDOWN_TIMEOUT;
+    ::close(listenfd_);
+    listenfd_ = -1;
+    unlink(socket_path_.c_str());
+}
+
+bool Daemon::replies_pending() const
+{
+    for (auto &entry : clients_)
+    {
+        const Client &client = *entry.second;
+        if (!client.lines.empty() || !client.replies.empty() ||
+            (client.fd >= 0 && !client.outbox.empty()))
+            return true;
+    }
+    return false;
+}
+
+// Requests that units did not answer before the shutdown deadline
+void Daemon::abandon_replies()
+{
+    for (auto &entry : clients_)
+    {
+        Client &client = *entry.second;
+        for (auto &slot : client.replies)
+        {
+            if (!slot->done)
+            {
+                slot->done = true;
+                slot->text = SHUTDOWN_ERROR;
+            }
+        }
+        for (size_t i = 0; i < client.lines.size(); i++)
+            reply(client, SHUTDOWN_ERROR);
+        client.lines.clear();
+        flush(client);
+    }
+}
+
+void Daemon::accept_clients()
+{
+    while (true)
+    {
+        int fd = accept4(listenfd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        auto client = std::unique_ptr<Client>(new Client());
+        client->id = next_id_++;
+        client->fd = fd;
+        client->unit = units_.empty() ? nullptr : units_.begin()->second.get();
+
+        try
+        {
+            add_fd(fd, client->id);
+        }
+        catch (const std::exception &)
+        {
+            ::close(fd);
+            continue;
+        }
+
+        clients_[client->id] = std::move(client);
+    }
+}
+
+void Daemon::receive(Client &client)
+{
+    char buf[1024];
+
+    while (!client.eof)
+    {
+        ssize_t n = ::read(client.fd, buf, sizeof(buf));
+        if (n > 0)
+        {
+            client.inbox.append(buf, n);
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && errno == EAGAIN)
+        {
+            break;
+        }
+        else if (n == 0)
+        {
+            // Replies to requests already sent are still delivered
+            client.eof = true;
+            update_events(client);
+            break;
+        }
+        else
+        {
+            ::close(client.fd);
+            client.fd = -1;
+            return;
+        }
+    }
+
+    size_t start = 0, end;
+    while ((end = client.inbox.find('\n', start)) != std::string::npos)
+    {
+        client.lines.push_back(client.inbox.substr(start, end - start));
+        start = end + 1;
+    }
+    client.inbox.erase(0, start);
+
+    if (client.inbox.size() > MAX_LINE)
+    {
+        ::close(client.fd);
+        client.fd = -1;
+    }
+}
+
+void Daemon::flush(Client &client)
+{
+    while (!client.replies.empty() && client.replies.front()->done)
+    {
+        client.outbox += client.replies.front()->text + "\n";
+        client.replies.pop_front();
+    }
+
+    if (client.fd < 0)
+    {
+        client.outbox.clear();
+        return;
+    }
+
+    while (!client.outbox.empty())
+    {
+        ssize_t n = ::write(client.fd, client.outbox.data(), client.outbox.size());
+        if (n > 0)
+        {
+            client.outbox.erase(0, n);
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && errno == EAGAIN)
+        {
+            break;
+        }
+        else
+        {
+            // Client went away, its requests still complete on the units
+            ::close(client.fd);
+            client.fd = -1;
+            return;
+        }
+    }
+
+    update_events(client);
+}
+
+// Read until the client shuts down, write while replies are waiting
+void Daemon::update_events(Client &client)
+{
+    uint32_t events = (client.eof ? 0u : EPOLLIN) | (client.outbox.empty() ? 0u : EPOLLOUT);
+    if (client.fd < 0 || events == client.events)
+        return;
+
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = client.id;
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, client.fd, &ev);
+    client.events = events;
+}
+
+void Daemon::drop(Client &client)
+{
+    for (auto &entry : units_)
+    {
+        Unit &unit = *entry.second;
+        for (Client *&holder : unit.locks)
+        {
+            if (holder == &client)
+                holder = nullptr;
+        }
+
+        // Changes collected by a client that left are not applied
+        if (unit.transaction == &client)
+        {
+            unit.transaction = nullptr;
+            unit.device->query("DISCARD", [](const std::string &, std::exception_ptr) {});
+        }
+    }
+
+    if (client.fd >= 0)
+        ::close(client.fd);
+    clients_.erase(client.id);
+}
+
+// Start received lines until one has to wait, returns true if any was started
+bool Daemon::pump(Client &client)
+{
+    bool progress = false;
+    while (!client.lines.empty())
+    {
+        std::string line = trim(client.lines.front());
+        if (!line.empty() && stopping_)
+            reply(client, SHUTDOWN_ERROR);
+        else if (!line.empty() && start(client, line) == BLOCKED)
+            break;
+
+        client.lines.pop_front();
+        progress = true;
+    }
+
+    if (progress)
+        flush(client);
+    return progress;
+}
+
+Daemon::Start Daemon::start(Client &client, const std::string &line)
+{
+    if (line[0] == '@')
+        return daemon_command(client, line);
+
+    Unit *unit = client.unit;
+    if (!unit)
+    {
+        reply(client, "ERR -241,\"Hardware missing\"");
+        return STARTED;
+    }
+
+    Command cmd = classify(line);
+
+    if (cmd.switches || cmd.transaction)
+    {
+        if (unit->transaction && unit->transaction != &client)
+            return BLOCKED;
+
+        for (int g = 0; g < GROUP_COUNT; g++)
+        {
+            if (((cmd.groups >> g) & 1) && unit->locks[g] && unit->locks[g] != &client)
+            {
+                reply(client, "ERR -221,\"Settings conflict;mux group " + std::to_string(g + 1) +
+                              " locked by another client\"");
+                return STARTED;
+            }
+        }
+    }
+
+    if (cmd.transaction > 0)
+        unit->transaction = &client;
+    else if (cmd.transaction < 0)
+        unit->transaction = nullptr;
+
+    submit(client, line, cmd.query);
+    return STARTED;
+}
+
+Daemon::Start Daemon::daemon_command(Client &client, const std::string &line)
+{
+    size_t space = line.find_first_of(" \t");
+    std::string name = upper(line.substr(0, space));
+    std::string arg = (space == std::string::npos) ? "" : trim(line.substr(space + 1));
+    Unit *unit = client.unit;
+
+    if (name == "@DEVICE")
+    {
+        Unit *selected = find_unit(arg);
+        if (!selected)
+        {
+            reply(client, "ERR -241,\"Hardware missing\"");
+            return STARTED;
+        }
+        client.unit = selected;
+        reply(client, "OK");
+    }
+    else if (name == "@DEVICE?")
+    {
+        reply(client, unit ? unit->device->serial() : "");
+    }
+    else if (name == "@LIST?")
+    {
+        std::string list;
+        for (auto &entry : units_)
+            list += (list.empty() ? "" : ",") + entry.first;
+        reply(client, list);
+    }
+    else if (name == "@LOCK" || name == "@UNLOCK")
+    {
+        bool lock = (name == "@LOCK");
+        uint32_t groups = 0;
+        for (const std::string &g : split(arg, ','))
+        {
+            int group = std::atoi(g.c_str());
+            if (group >= 1 && group <= GROUP_COUNT)
+                groups |= 1 << (group - 1);
+            else if (lock || !trim(g).empty())
+                groups = UINT32_MAX;
+        }
+        if (!lock && trim(arg).empty())
+            groups = ALL_GROUPS;
+
+        if (!unit || groups > ALL_GROUPS)
+        {
+            reply(client, unit ? "ERR -222,\"Data out of range\"" : "ERR -241,\"Hardware missing\"");
+            return STARTED;
+        }
+
+        for (int g = 0; g < GROUP_COUNT; g++)
+        {
+            // All listed groups are taken at once, so two clients
+            // locking the same groups cannot deadlock
+            if (lock && ((groups >> g) & 1) && unit->locks[g] && unit->locks[g] != &client)
+                return BLOCKED;
+        }
+
+        for (int g = 0; g < GROUP_COUNT; g++)
+        {
+            if ((groups >> g) & 1)
+            {
+                if (lock)
+                    unit->locks[g] = &client;
+                else if (unit->locks[g] == &client)
+                    unit->locks[g] = nullptr;
+            }
+        }
+        reply(client, "OK");
+    }
+    else if (name == "@STATS?")
+    {
+        if (!unit)
+        {
+            reply(client, "ERR -241,\"Hardware missing\"");
+            return STARTED;
+        }
+
+        // Include the outcome of the client's own earlier requests
+        if (std::any_of(client.replies.begin(), client.replies.end(),
+                        [](const std::shared_ptr<Reply> &r) { return !r->done; }))
+            return BLOCKED;
+
+        uint64_t answered = unit->requests - unit->depth;
+        char text[160];
+        std::snprintf(text, sizeof(text), "%llu,%llu,%u,%u,%llu,%llu,%llu",
+                      (unsigned long long)unit->requests, (unsigned long long)unit->errors,
+                      unit->depth, unit->max_depth,
+                      (unsigned long long)(answered ? unit->latency_min_us : 0),
+                      (unsigned long long)(answered ? unit->latency_sum_us / answered : 0),
+                      (unsigned long long)unit->latency_max_us);
+        reply(client, text);
+    }
+    else
+    {
+        reply(client, "ERR -113,\"Undefined header\"");
+    }
+
+    return STARTED;
+}
+
+void Daemon::reply(Client &client, const std::string &text)
+{
+    auto slot = std::make_shared<Reply>();
+    slot->done = true;
+    slot->text = text;
+    client.replies.push_back(slot);
+}
+
+void Daemon::submit(Client &client, const std::string &line, bool query)
+{
+    Unit *unit = client.unit;
+    auto slot = std::make_shared<Reply>();
+    client.replies.push_back(slot);
+
+    unit->requests++;
+    unit->depth++;
+    if (unit->depth > unit->max_depth)
+        unit->max_depth = unit->depth;
+
+    uint64_t client_id = client.id;
+    Clock::time_point start = Clock::now();
+
+    unit->device->query(line, [this, client_id, unit, slot, start, query](
+                                  const std::string &response, std::exception_ptr error) {
+        Completion c = {client_id, unit, slot, start, query ? response : "OK", false};
+
+        if (error)
+        {
+            c.error = true;
+            try
+            {
+                std::rethrow_exception(error);
+            }
+            catch (const relaymux::ScpiError &e)
+            {
+                c.text = std::string("ERR ") + e.what();
+            }
+            catch (const std::exception &e)
+            {
+                c.text = std::string("ERR -240,\"Hardware error;") + e.what() + "\"";
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        completions_.push_back(std::move(c));
+
+        uint64_t one = 1;
+        if (::write(completionfd_, &one, sizeof(one)) < 0)
+        {
+            // Counter is already non-zero, main loop will wake up anyway
+        }
+    });
+}
+
+void Daemon::handle_completions()
+{
+    uint64_t value;
+    while (::read(completionfd_, &value, sizeof(value)) > 0) {}
+
+    std::vector<Completion> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done.swap(completions_);
+    }
+
+    Clock::time_point now = Clock::now();
+    for (Completion &c : done)
+    {
+        Unit &unit = *c.unit;
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(now - c.start).count();
+        unit.depth--;
+        unit.errors += c.error;
+        unit.latency_sum_us += us;
+        if (us < unit.latency_min_us) unit.latency_min_us = us;
+        if (us > unit.latency_max_us) unit.latency_max_us = us;
+
+        c.reply->done = true;
+        c.reply->text = std::move(c.text);
+    }
+
+    for (Completion &c : done)
+    {
+        auto it = clients_.find(c.client_id);
+        if (it != clients_.end())
+            flush(*it->second);
+    }
+}
+
+void Daemon::write_metrics()
+{
+    std::string tmp = metrics_path_ + ".tmp";
+    FILE *f = std::fopen(tmp.c_str(), "w");
+    if (!f)
+        return;
+
+    std::fprintf(f, "# HELP relaymux_clients Connected clients\n");
+    std::fprintf(f, "# TYPE relaymux_clients gauge\n");
+    std::fprintf(f, "relaymux_clients %zu\n", clients_.size());
+
+    std::fprintf(f, "# HELP relaymux_requests_total Requests sent to the unit\n");
+    std::fprintf(f, "# TYPE relaymux_requests_total counter\n");
+    for (auto &entry : units_)
+        std::fprintf(f, "relaymux_requests_total{serial=\"%s\"} %llu\n", entry.first.c_str(),
+                     (unsigned long long)entry.second->requests);
+
+    std::fprintf(f, "# HELP relaymux_errors_total Requests that failed\n");
+    std::fprintf(f, "# TYPE relaymux_errors_total counter\n");
+    for (auto &entry : units_)
+        std::fprintf(f, "relaymux_errors_total{serial=\"%s\"} %llu\n", entry.first.c_str(),
+                     (unsigned long long)entry.second->errors);
+
+    std::fprintf(f, "# HELP relaymux_queue_depth Requests sent and not yet answered\n");
+    std::fprintf(f, "# TYPE relaymux_queue_depth gauge\n");
+    for (auto &entry : units_)
+        std::fprintf(f, "relaymux_queue_depth{serial=\"%s\"} %u\n", entry.first.c_str(),
+                     entry.second->depth);
+
+    std::fprintf(f, "# HELP relaymux_queue_depth_max Highest queue depth since start\n");
+    std::fprintf(f, "# TYPE relaymux_queue_depth_max gauge\n");
+    for (auto &entry : units_)
+        std::fprintf(f, "relaymux_queue_depth_max{serial=\"%s\"} %u\n", entry.first.c_str(),
+                     entry.second->max_depth);
+
+    std::fprintf(f, "# HELP relaymux_latency_seconds Time from request to reply\n");
+    std::fprintf(f, "# TYPE relaymux_latency_seconds summary\n");
+    for (auto &entry : units_)
+    {
+        const Unit &unit = *entry.second;
+        std::fprintf(f, "relaymux_latency_seconds_sum{serial=\"%s\"} %.6f\n", entry.first.c_str(),
+                     unit.latency_sum_us / 1e6);
+        std::fprintf(f, "relaymux_latency_seconds_count{serial=\"%s\"} %llu\n", entry.first.c_str(),
+                     (unsigned long long)(unit.requests - unit.depth));
+    }
+
+    std::fprintf(f, "# HELP relaymux_latency_max_seconds Longest time from request to reply\n");
+    std::fprintf(f, "# TYPE relaymux_latency_max_seconds gauge\n");
+    for (auto &entry : units_)
+        std::fprintf(f, "relaymux_latency_max_seconds{serial=\"%s\"} %.6f\n", entry.first.c_str(),
+                     entry.second->latency_max_us / 1e6);
+
+    // Readers see either the old or the new file, never a partial one
+    if (std::fclose(f) == 0)
+        std::rename(tmp.c_str(), metrics_path_.c_str());
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string socket_path = DEFAULT_SOCKET;
+    std::string metrics_path;
+    std::vector<std::string> serials;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:m:")) != -1)
+    {
+        if (opt == 's')
+        {
+            socket_path = optarg;
+        }
+        else if (opt == 'm')
+        {
+            metrics_path = optarg;
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [-s socket] [-m metrics_file] [serial...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (int i = optind; i < argc; i++)
+        serials.push_back(argv[i]);
+
+    // Clients that disconnect mid-reply are handled through write() errors
+    signal(SIGPIPE, SIG_IGN);
+
+    // Blocked before the client library starts its thread, so that they are
+    // only delivered through the daemon's signalfd
+    sigset_t signals = shutdown_signals();
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+
+    try
+    {
+        Daemon daemon(socket_path, metrics_path);
+        daemon.open_units(serials);
+        daemon.run();
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
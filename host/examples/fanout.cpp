@@ -0,0 +1,83 @@
+// Send one command to many relay mux units at once and wait until all have settled.
+//
+// Usage: relaymux-fanout <command> [serial...]
+// Without serial numbers, all connected units are used. Commands ending
+// in '?' are sent as queries and the response of each unit is printed.
+
+#include "relaymux/relaymux.h"
+
+#include <chrono>
+#include <cstdio>
+#include <exception>
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <command> [serial...]\n", argv[0]);
+        return 1;
+    }
+
+    std::string command = argv[1];
+    bool is_query = !command.empty() && command.back() == '?';
+
+    try
+    {
+        relaymux::Client client;
+        std::vector<relaymux::Device *> devices;
+
+        if (argc > 2)
+        {
+            for (int i = 2; i < argc; i++)
+                devices.push_back(&client.open(argv[i]));
+        }
+        else
+        {
+            devices = client.open_all();
+        }
+
+        if (devices.empty())
+        {
+            std::fprintf(stderr, "No relay mux units found\n");
+            return 1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::future<std::string>> queries;
+        std::vector<std::future<void>> actuations;
+
+        for (relaymux::Device *dev : devices)
+        {
+            if (is_query)
+                queries.push_back(dev->query(command));
+            else
+                actuations.push_back(dev->actuate(command));
+        }
+
+        int status = 0;
+        for (size_t i = 0; i < devices.size(); i++)
+        {
+            try
+            {
+                if (is_query)
+                    std::printf("%s: %s\n", devices[i]->serial().c_str(), queries[i].get().c_str());
+                else
+                    actuations[i].get();
+            }
+            catch (const std::exception &e)
+            {
+                std::fprintf(stderr, "%s: %s\n", devices[i]->serial().c_str(), e.what());
+                status = 1;
+            }
+        }
+
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        std::fprintf(stderr, "%zu units done in %.1f ms\n", devices.size(), elapsed.count());
+        return status;
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
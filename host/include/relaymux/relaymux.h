@@ -0,0 +1,116 @@
+// Asynchronous host client for USB Relay Mux units.
+//
+// One Client runs an epoll event loop in a background thread and can talk to
+// any number of units at once. Commands to a unit are pipelined: they are
+// written without waiting for earlier responses, and each response is matched
+// to its command in order. Results are delivered through std::future.
+
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace relaymux {
+
+// Unit found on the USB bus
+struct DeviceInfo {
+    std::string path;   // Serial port, e.g. /dev/ttyACM0
+    std::string serial; // USB serial number string, as reported by *IDN?
+};
+
+// Find connected units by USB vendor/product ID and product string
+std::vector<DeviceInfo> discover();
+
+// Error reported by the unit for a command, e.g. -222 "Data out of range"
+class ScpiError : public std::runtime_error {
+public:
+    ScpiError(int code, const std::string &message);
+    int code() const { return code_; }
+
+private:
+    int code_;
+};
+
+namespace detail {
+struct Connection;
+struct Loop;
+}
+
+// Connection to one unit, owned by the Client that opened it.
+// Methods are thread-safe and return immediately.
+class Device {
+public:
+    const std::string &path() const;
+    const std::string &serial() const;
+
+    // Send a query and get its response, e.g. query("GET?") -> "5"
+    std::future<std::string> query(const std::string &command);
+
+    // Callback form of query(), for event-driven callers. The callback runs
+    // on the client's event loop thread and must not block, but it may submit
+    // further commands. On failure the response is empty and error holds the
+    // exception.
+    using Callback = std::function<void(const std::string &response, std::exception_ptr error)>;
+    void query(const std::string &command, Callback callback);
+
+    // Send a command, completes when the unit has executed it.
+    // Relay commands are overlapped, so relays may still be switching.
+    std::future<void> send(const std::string &command);
+
+    // Send a command, completes when relays have settled (uses *OPC?)
+    std::future<void> actuate(const std::string &command);
+
+    // Block the calling thread until the unit requests service, see *SRE.
+    // E.g. after "STAT:OPER:PTR 0;NTR 2;ENAB 2;*SRE 128" this returns when
+    // relays have settled. Read STAT:OPER? afterwards to re-arm.
+    void wait_service_request();
+
+private:
+    friend class Client;
+    explicit Device(std::shared_ptr<detail::Connection> conn);
+
+    std::shared_ptr<detail::Connection> conn_;
+};
+
+class Client {
+public:
+    Client();
+    ~Client();
+
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    // Open unit by serial number, throws std::runtime_error if not found
+    Device &open(const std::string &serial);
+
+    // Open unit by serial port path
+    Device &open_path(const std::string &path, const std::string &serial = "");
+
+    // Open all units returned by discover()
+    std::vector<Device *> open_all();
+
+    // While a Batch exists, submitted commands are only queued. They are
+    // written when the last Batch ends, with one write() per unit.
+    class Batch {
+    public:
+        explicit Batch(Client &client);
+        ~Batch();
+
+        Batch(const Batch &) = delete;
+        Batch &operator=(const Batch &) = delete;
+
+    private:
+        Client &client_;
+    };
+
+private:
+    std::unique_ptr<detail::Loop> loop_;
+    std::vector<std::unique_ptr<Device>> devices_;
+};
+
+} // namespace relaymux
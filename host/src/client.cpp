@@ -0,0 +1,546 @@
+#include "relaymux/relaymux.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+namespace relaymux {
+
+ScpiError::ScpiError(int code, const std::string &message)
+    : std::runtime_error(std::to_string(code) + ",\"" + message + "\""), code_(code)
+{
+}
+
+namespace detail {
+
+// Each command is sent followed by a terminating query that cannot fail,
+// e.g. "CLOSE (@1);*STB?". The unit answers every such message with exactly
+// one line, where the result of the terminator is the last ';' separated
+// field. Error lines for the command are printed before it.
+struct Transaction {
+    std::function<void(const std::string &)> complete;
+    std::function<void(std::exception_ptr)> fail;
+    std::exception_ptr error; // First error reported for this command
+};
+
+struct Connection {
+    Loop *loop;
+    DeviceInfo info;
+    int fd = -1;
+    std::string outbox;
+    std::string inbox;
+    std::deque<Transaction> pending;
+    bool want_write = false; // EPOLLOUT is enabled
+};
+
+struct Loop {
+    int epfd = -1;
+    int wakefd = -1;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Connection>> conns;
+    // Transactions that have a response or error, run by finish() without
+    // the mutex, so that their callbacks can submit new commands
+    std::vector<std::pair<Transaction, std::string>> completed;
+    int batches = 0; // Open Client::Batch objects, wake() is deferred while non-zero
+    bool stop = false;
+    std::thread thread;
+
+    Loop();
+    ~Loop();
+
+    std::shared_ptr<Connection> open(const std::string &path, const std::string &serial);
+    void submit(Connection &conn, const std::string &command, const char *terminator,
+                Transaction transaction);
+
+    void run();
+    void wake();
+    void update_events(Connection &conn);
+    void close(Connection &conn, std::exception_ptr reason);
+    void flush(Connection &conn);
+    void receive(Connection &conn);
+    void handle_line(Connection &conn, const std::string &line);
+    void finish();
+};
+
+// Device errors look like: -222,"Data out of range"
+// They are written when they occur, so output of earlier queries in the
+// same command line can precede the error on its line.
+static bool parse_error(const std::string &line, int &code, std::string &message)
+{
+    if (line.size() < 5 || line.back() != '"')
+        return false;
+
+    size_t quote = line.rfind(",\"", line.size() - 2);
+    if (quote == std::string::npos)
+        return false;
+
+    size_t start = quote;
+    while (start > 0 && std::isdigit(static_cast<unsigned char>(line[start - 1])))
+        start--;
+    if (start == quote || start == 0 || line[start - 1] != '-')
+        return false;
+    start--;
+
+    code = std::stoi(line.substr(start, quote - start));
+    message = line.substr(quote + 2, line.size() - quote - 3);
+    return true;
+}
+
+Loop::Loop()
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        throw std::system_error(errno, std::generic_category(), "epoll_create1");
+
+    wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakefd < 0)
+    {
+        int err = errno;
+        ::close(epfd);
+        throw std::system_error(err, std::generic_category(), "eventfd");
+    }
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+    thread = std::thread(&Loop::run, this);
+}
+
+Loop::~Loop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        wake();
+    }
+    thread.join();
+
+    auto reason = std::make_exception_ptr(std::runtime_error("client closed"));
+    for (auto &conn : conns)
+    {
+        close(*conn, reason);
+    }
+    finish();
+
+    ::close(wakefd);
+    ::close(epfd);
+}
+
+std::shared_ptr<Connection> Loop::open(const std::string &path, const std::string &serial)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    termios tio;
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    // Drop output left over from a previous session
+    tcflush(fd, TCIOFLUSH);
+
+    auto conn = std::make_shared<Connection>();
+    conn->loop = this;
+    conn->info = {path, serial};
+    conn->fd = fd;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn.get();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "epoll_ctl");
+    }
+
+    conns.push_back(conn);
+    return conn;
+}
+
+void Loop::submit(Connection &conn, const std::string &command, const char *terminator,
+                  Transaction transaction)
+{
+    // Trailing separators would leave an empty message unit before the terminator
+    size_t len = command.find_last_not_of(" \t\r\n;");
+    std::string message = (len == std::string::npos) ? "" : command.substr(0, len + 1) + ";";
+    message += terminator;
+    message += "\n";
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (conn.fd >= 0)
+        {
+            conn.outbox += message;
+            conn.pending.push_back(std::move(transaction));
+            if (batches == 0)
+                wake();
+            return;
+        }
+    }
+
+    transaction.fail(std::make_exception_ptr(
+        std::runtime_error(conn.info.path + ": device disconnected")));
+}
+
+void Loop::wake()
+{
+    uint64_t one = 1;
+    if (::write(wakefd, &one, sizeof(one)) < 0)
+    {
+        // Counter is already non-zero, loop will wake up anyway
+    }
+}
+
+void Loop::run()
+{
+    epoll_event events[16];
+
+    while (true)
+    {
+        int count = epoll_wait(epfd, events, 16, -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stop)
+            break;
+
+        for (int i = 0; i < count; i++)
+        {
+            Connection *conn = static_cast<Connection *>(events[i].data.ptr);
+
+            if (conn == nullptr)
+            {
+                // New commands were queued by other threads
+                uint64_t value;
+                while (::read(wakefd, &value, sizeof(value)) > 0) {}
+
+                for (auto &c : conns)
+                {
+                    if (c->fd >= 0 && !c->outbox.empty())
+                        flush(*c);
+                }
+                continue;
+            }
+
+            if (events[i].events & EPOLLIN)
+                receive(*conn);
+
+            if (conn->fd >= 0 && (events[i].events & EPOLLOUT))
+                flush(*conn);
+
+            if (conn->fd >= 0 && (events[i].events & (EPOLLHUP | EPOLLERR)))
+            {
+                close(*conn, std::make_exception_ptr(
+                    std::runtime_error(conn->info.path + ": device disconnected")));
+            }
+        }
+
+        lock.unlock();
+        finish();
+    }
+}
+
+void Loop::finish()
+{
+    std::vector<std::pair<Transaction, std::string>> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.swap(completed);
+    }
+
+    for (auto &entry : done)
+    {
+        Transaction &t = entry.first;
+        if (t.error)
+            t.fail(t.error);
+        else
+            t.complete(entry.second);
+    }
+}
+
+void Loop::update_events(Connection &conn)
+{
+    bool want_write = !conn.outbox.empty();
+    if (want_write == conn.want_write)
+        return;
+
+    epoll_event ev = {};
+    ev.events = want_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.ptr = &conn;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+    conn.want_write = want_write;
+}
+
+void Loop::close(Connection &conn, std::exception_ptr reason)
+{
+    if (conn.fd >= 0)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        ::close(conn.fd);
+        conn.fd = -1;
+    }
+
+    conn.outbox.clear();
+    while (!conn.pending.empty())
+    {
+        Transaction t = std::move(conn.pending.front());
+        conn.pending.pop_front();
+        t.error = reason;
+        completed.emplace_back(std::move(t), std::string());
+    }
+}
+
+void Loop::flush(Connection &conn)
+{
+    while (!conn.outbox.empty())
+    {
+        ssize_t n = ::write(conn.fd, conn.outbox.data(), conn.outbox.size());
+        if (n > 0)
+        {
+            conn.outbox.erase(0, n);
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && errno == EAGAIN)
+        {
+            // Unit is applying flow control, continue on EPOLLOUT
+            break;
+        }
+        else
+        {
+            close(conn, std::make_exception_ptr(
+                std::system_error(errno, std::generic_category(), conn.info.path)));
+            return;
+        }
+    }
+
+    update_events(conn);
+}
+
+void Loop::receive(Connection &conn)
+{
+    char buf[512];
+
+    while (conn.fd >= 0)
+    {
+        ssize_t n = ::read(conn.fd, buf, sizeof(buf));
+        if (n > 0)
+        {
+            conn.inbox.append(buf, n);
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && errno == EAGAIN)
+        {
+            break;
+        }
+        else
+        {
+            close(conn, std::make_exception_ptr(
+                std::runtime_error(conn.info.path + ": device disconnected")));
+            return;
+        }
+    }
+
+    size_t start = 0, end;
+    while ((end = conn.inbox.find('\n', start)) != std::string::npos)
+    {
+        size_t len = end - start;
+        if (len > 0 && conn.inbox[end - 1] == '\r')
+            len--;
+
+        handle_line(conn, conn.inbox.substr(start, len));
+        start = end + 1;
+    }
+    conn.inbox.erase(0, start);
+}
+
+void Loop::handle_line(Connection &conn, const std::string &line)
+{
+    if (line.empty() || conn.pending.empty())
+        return;
+
+    Transaction &t = conn.pending.front();
+
+    int code;
+    std::string message;
+    if (parse_error(line, code, message))
+    {
+        if (!t.error)
+            t.error = std::make_exception_ptr(ScpiError(code, message));
+        return;
+    }
+
+    // Strip the result of the terminating query
+    size_t sep = line.rfind(';');
+    std::string response = (sep == std::string::npos) ? "" : line.substr(0, sep);
+
+    completed.emplace_back(std::move(t), response);
+    conn.pending.pop_front();
+}
+
+} // namespace detail
+
+namespace {
+
+std::future<void> submit_void(detail::Connection &conn, const std::string &command,
+                              const char *terminator)
+{
+    auto promise = std::make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+
+    detail::Transaction t;
+    t.complete = [promise](const std::string &) { promise->set_value(); };
+    t.fail = [promise](std::exception_ptr e) { promise->set_exception(e); };
+    conn.loop->submit(conn, command, terminator, std::move(t));
+
+    return future;
+}
+
+} // namespace
+
+Device::Device(std::shared_ptr<detail::Connection> conn)
+    : conn_(std::move(conn))
+{
+}
+
+const std::string &Device::path() const
+{
+    return conn_->info.path;
+}
+
+const std::string &Device::serial() const
+{
+    return conn_->info.serial;
+}
+
+std::future<std::string> Device::query(const std::string &command)
+{
+    auto promise = std::make_shared<std::promise<std::string>>();
+    auto future = promise->get_future();
+
+    detail::Transaction t;
+    t.complete = [promise](const std::string &response) { promise->set_value(response); };
+    t.fail = [promise](std::exception_ptr e) { promise->set_exception(e); };
+    conn_->loop->submit(*conn_, command, "*STB?", std::move(t));
+
+    return future;
+}
+
+void Device::query(const std::string &command, Callback callback)
+{
+    auto shared = std::make_shared<Callback>(std::move(callback));
+
+    detail::Transaction t;
+    t.complete = [shared](const std::string &response) { (*shared)(response, nullptr); };
+    t.fail = [shared](std::exception_ptr e) { (*shared)(std::string(), e); };
+    conn_->loop->submit(*conn_, command, "*STB?", std::move(t));
+}
+
+std::future<void> Device::send(const std::string &command)
+{
+    return submit_void(*conn_, command, "*STB?");
+}
+
+std::future<void> Device::actuate(const std::string &command)
+{
+    return submit_void(*conn_, command, "*OPC?");
+}
+
+void Device::wait_service_request()
+{
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(conn_->loop->mutex);
+        fd = conn_->fd;
+    }
+
+    if (fd < 0)
+        throw std::runtime_error(conn_->info.path + ": device disconnected");
+
+    // Unit toggles the ring indicator for each service request
+    while (ioctl(fd, TIOCMIWAIT, TIOCM_RNG) < 0)
+    {
+        if (errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), conn_->info.path);
+    }
+}
+
+Client::Client()
+    : loop_(new detail::Loop())
+{
+}
+
+Client::~Client() = default;
+
+Device &Client::open(const std::string &serial)
+{
+    for (const DeviceInfo &info : discover())
+    {
+        if (info.serial == serial)
+            return open_path(info.path, info.serial);
+    }
+
+    throw std::runtime_error("relay mux with serial " + serial + " not found");
+}
+
+Device &Client::open_path(const std::string &path, const std::string &serial)
+{
+    devices_.emplace_back(new Device(loop_->open(path, serial)));
+    return *devices_.back();
+}
+
+Client::Batch::Batch(Client &client)
+    : client_(client)
+{
+    std::lock_guard<std::mutex> lock(client_.loop_->mutex);
+    client_.loop_->batches++;
+}
+
+Client::Batch::~Batch()
+{
+    std::lock_guard<std::mutex> lock(client_.loop_->mutex);
+    if (--client_.loop_->batches == 0)
+        client_.loop_->wake();
+}
+
+std::vector<Device *> Client::open_all()
+{
+    std::vector<Device *> result;
+    for (const DeviceInfo &info : discover())
+    {
+        result.push_back(&open_path(info.path, info.serial));
+    }
+    return result;
+}
+
+} // namespace relaymux
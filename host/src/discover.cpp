@@ -0,0 +1,70 @@
+// Discovery of units through sysfs: each ttyACM device links to its USB
+// interface, whose parent directory holds the USB device descriptor fields.
+
+#include "relaymux/relaymux.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+
+namespace relaymux {
+
+namespace {
+
+// Must match device descriptor in src/usb_serial.c
+const char *const VENDOR_ID = "0483";
+const char *const PRODUCT_ID = "5640";
+const char *const PRODUCT_STRING = "Relay Mux";
+
+std::string read_attr(const std::string &dir, const char *name)
+{
+    std::ifstream file(dir + "/" + name);
+    std::string value;
+    std::getline(file, value);
+    return value;
+}
+
+} // namespace
+
+std::vector<DeviceInfo> discover()
+{
+    std::vector<DeviceInfo> result;
+
+    DIR *dir = opendir("/sys/class/tty");
+    if (!dir)
+        return result;
+
+    while (struct dirent *entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name.compare(0, 6, "ttyACM") != 0)
+            continue;
+
+        char iface[PATH_MAX];
+        std::string link = "/sys/class/tty/" + name + "/device";
+        if (!realpath(link.c_str(), iface))
+            continue;
+
+        std::string usbdev = iface;
+        usbdev = usbdev.substr(0, usbdev.rfind('/'));
+
+        if (read_attr(usbdev, "idVendor") == VENDOR_ID &&
+            read_attr(usbdev, "idProduct") == PRODUCT_ID &&
+            read_attr(usbdev, "product") == PRODUCT_STRING)
+        {
+            result.push_back({"/dev/" + name, read_attr(usbdev, "serial")});
+        }
+    }
+
+    closedir(dir);
+
+    std::sort(result.begin(), result.end(), [](const DeviceInfo &a, const DeviceInfo &b) {
+        return a.serial < b.serial;
+    });
+    return result;
+}
+
+} // namespace relaymux
@@ -0,0 +1,209 @@
+// Replies of relaymuxd to several clients sharing one emulated unit.
+//
+// Usage: daemon_replies <relaymuxd> <emulator>
+// Starts the device emulator on a pseudo-terminal and the daemon on it,
+// then checks that each client gets exactly one reply per request, in
+// request order, also when requests fail, that @STATS? counts the
+// failures, and that SIGTERM still answers requests in flight.
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int g_failures = 0;
+
+void check(const std::string &what, const std::string &got, const std::string &expected)
+{
+    if (got != expected)
+    {
+        std::fprintf(stderr, "%s: got '%s', expected '%s'\n", what.c_str(), got.c_str(),
+                     expected.c_str());
+        g_failures++;
+    }
+}
+
+pid_t spawn(const std::vector<std::string> &args)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        std::vector<char *> argv;
+        for (const std::string &a : args)
+            argv.push_back(const_cast<char *>(a.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        std::_Exit(127);
+    }
+    return pid;
+}
+
+// Retry until the daemon listens, it first has to open the unit
+int connect_daemon(const std::string &path)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0)
+        {
+            timeval timeout = {5, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+        ::close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return -1;
+}
+
+struct Connection {
+    int fd;
+    std::string inbox;
+
+    void send(const std::string &text)
+    {
+        if (::write(fd, text.data(), text.size()) != static_cast<ssize_t>(text.size()))
+            g_failures++;
+    }
+
+    // Empty string on timeout or disconnect
+    std::string readline()
+    {
+        size_t end;
+        while ((end = inbox.find('\n')) == std::string::npos)
+        {
+            char buf[256];
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if (n <= 0)
+                return "";
+            inbox.append(buf, n);
+        }
+        std::string line = inbox.substr(0, end);
+        inbox.erase(0, end + 1);
+        return line;
+    }
+};
+
+std::string field(const std::string &csv, int index)
+{
+    size_t start = 0;
+    for (int i = 0; i < index && start != std::string::npos; i++)
+    {
+        start = csv.find(',', start);
+        if (start != std::string::npos)
+            start++;
+    }
+    return start == std::string::npos ? "" : csv.substr(start, csv.find(',', start) - start);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::fprintf(stderr, "Usage: %s <relaymuxd> <emulator>\n", argv[0]);
+        return 2;
+    }
+
+    char dir_template[] = "/tmp/relaymux-test.XXXXXX";
+    if (!mkdtemp(dir_template))
+        return 2;
+    std::string dir = dir_template;
+    std::string link = dir + "/tty";
+    std::string socket_path = dir + "/sock";
+
+    pid_t emulator = spawn({argv[2], "-f", "-p", link});
+    for (int i = 0; i < 100 && access(link.c_str(), F_OK) != 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    pid_t daemon = spawn({argv[1], "-s", socket_path, link});
+
+    Connection a = {connect_daemon(socket_path), ""};
+    Connection b = {connect_daemon(socket_path), ""};
+
+    if (a.fd < 0 || b.fd < 0)
+    {
+        std::fprintf(stderr, "cannot connect to %s\n", socket_path.c_str());
+        g_failures++;
+    }
+    else
+    {
+        const int rounds = 20;
+
+        // Both clients send everything before reading, so their requests
+        // share batches and failures sit between other clients' requests
+        for (int i = 0; i < rounds; i++)
+        {
+            a.send("CLOSE (@1)\nCLOSE (@99)\nCLOSE? (@1)\n");
+            b.send("NOSUCH\nOPEN (@2);CLOSE? (@2)\nROUT:CAT?\n");
+        }
+
+        for (int i = 0; i < rounds; i++)
+        {
+            std::string round = " in round " + std::to_string(i);
+            check("client a CLOSE" + round, a.readline(), "OK");
+            check("client a error" + round, a.readline(), "ERR -222,\"Data out of range\"");
+            check("client a query" + round, a.readline(), "1");
+            check("client b error" + round, b.readline(), "ERR -113,\"Undefined header\"");
+            check("client b query" + round, b.readline(), "0");
+            check("client b catalog" + round, b.readline(), "\"\"");
+        }
+
+        // Statistics include the failure just before them
+        b.send("CLOSE (@99)\n@STATS?\n");
+        check("client b last error", b.readline(), "ERR -222,\"Data out of range\"");
+        std::string stats = b.readline();
+        check("requests", field(stats, 0), std::to_string(6 * rounds + 1));
+        check("errors", field(stats, 1), std::to_string(2 * rounds + 1));
+        check("depth", field(stats, 2), "0");
+
+        // With the emulator stopped, the request is still in flight on the
+        // unit when the signal arrives, and is answered after it
+        kill(emulator, SIGSTOP);
+        a.send("CLOSE (@3);*OPC?\n");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        kill(daemon, SIGTERM);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (access(socket_path.c_str(), F_OK) == 0)
+        {
+            std::fprintf(stderr, "socket %s not removed at shutdown\n", socket_path.c_str());
+            g_failures++;
+        }
+        kill(emulator, SIGCONT);
+        check("reply at shutdown", a.readline(), "1");
+        check("end of replies", a.readline(), "");
+    }
+
+    kill(daemon, SIGTERM);
+    int status = 0;
+    waitpid(daemon, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        std::fprintf(stderr, "daemon did not exit cleanly: status %d\n", status);
+        g_failures++;
+    }
+
+    kill(emulator, SIGTERM);
+    waitpid(emulator, nullptr, 0);
+    unlink(socket_path.c_str());
+    unlink(link.c_str());
+    rmdir(dir.c_str());
+
+    if (g_failures == 0)
+        std::printf("OK\n");
+    return g_failures ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+// Command throughput benchmark for host builds.
+// Feeds command streams through the USB CDC glue into SCPI_Input() and
+// reports throughput and per-command timing.
+//
+// Usage: program [recorded_stream.txt]
+// The optional file contains one SCPI command per line, e.g. captured from a test script.
+
+#include "board.h"
+#include "usb_serial.h"
+#include "sim.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0
+#endif
+
+#define BENCH_ITERATIONS 10000
+#define BENCH_MAX_LINE 256
+
+typedef struct {
+    const char *name;
+    uint32_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t total_cycles;
+} bench_stats_t;
+
+static size_t g_response_bytes;
+
+static void count_response(uint8_t ep_addr, const uint8_t *data, size_t len)
+{
+    g_response_bytes += len;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Send one command line and process it, returning false if the device stalls.
+static bool run_command(const char *line, bench_stats_t *stats)
+{
+    size_t len = strlen(line);
+    size_t pos = 0;
+    int idle_polls = 0;
+
+    uint64_t start_ns = now_ns();
+    uint64_t start_cycles = BENCH_CYCLES();
+
+    while (pos < len)
+    {
+        size_t n = sim_usb_receive(line + pos, len - pos);
+        pos += n;
+        usb_serial_poll();
+        while (sim_usb_service());
+
+        if (n == 0 && ++idle_polls > 1000)
+        {
+            fprintf(stderr, "Device stopped accepting data at command: %s", line);
+            return false;
+        }
+    }
+    usb_serial_poll();
+    while (sim_usb_service());
+
+    uint64_t cycles = BENCH_CYCLES() - start_cycles;
+    uint64_t elapsed = now_ns() - start_ns;
+
+    stats->count++;
+    stats->total_ns += elapsed;
+    stats->total_cycles += cycles;
+    if (elapsed > stats->max_ns) stats->max_ns = elapsed;
+
+    // Let relays settle outside of the measurement
+    while (relays_busy()) sim_tick();
+
+    return true;
+}
+
+static void print_stats(const bench_stats_t *stats)
+{
+    if (stats->count == 0) return;
+
+    printf("%-16s %8u cmds %10.0f cmds/s %8.0f ns/cmd %8llu cycles/cmd %8llu ns worst\n",
+           stats->name, stats->count,
+           stats->count * 1e9 / stats->total_ns,
+           (double)stats->total_ns / stats->count,
+           (unsigned long long)(stats->total_cycles / stats->count),
+           (unsigned long long)stats->max_ns);
+}
+
+static bool bench_command(const char *name, const char *line)
+{
+    bench_stats_t stats = {.name = name};
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        if (!run_command(line, &stats)) return false;
+    }
+
+    print_stats(&stats);
+    return true;
+}
+
+static bool bench_stream(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    bench_stats_t stats = {.name = "stream"};
+    char line[BENCH_MAX_LINE];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f))
+    {
+        if (line[0] == '\n' || line[0] == '#') continue;
+        ok = run_command(line, &stats);
+    }
+
+    fclose(f);
+    print_stats(&stats);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    board_init();
+    set_relay_pwr(true);
+    sim_usb_transmit_hook = count_response;
+    usb_serial_start();
+
+    bool ok = true;
+    ok = ok && bench_command("CLOSe", "CLOSE (@1,5)\n");
+    ok = ok && bench_command("OPEN", "OPEN (@1:8)\n");
+    ok = ok && bench_command("SET:MBB", "SET:MBB 165\n");
+    ok = ok && bench_command("CLOSe:STATe?", "CLOSE:STATE?\n");
+    ok = ok && bench_command("CLOSe?", "CLOSE? (@1,2,3,4,5,6,7,8)\n");
+    ok = ok && bench_command("CLOSe;*STB?", "CLOSE (@1,5);*STB?\n");
+    ok = ok && bench_command("STAT:OPER:COND?", "STAT:OPER:COND?\n");
+
+    if (argc > 1)
+    {
+        ok = ok && bench_stream(argv[1]);
+    }
+
+    printf("Response bytes: %zu\n", g_response_bytes);
+    return ok ? 0 : 1;
+}
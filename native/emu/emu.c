@@ -0,0 +1,232 @@
+// Device emulator for host builds.
+// Runs the firmware command path against simulated relays and serves the
+// SCPI serial port on a pseudo-terminal, so that test sequencers can be
+// exercised without hardware.
+//
+// Usage: program [-f] [-p link] [-l logfile]
+//   -f          Fast mode: simulated time skips ahead while relays are settling,
+//               instead of following the wall clock.
+//   -p link     Create symlink to the pty, e.g. /tmp/ttyRelayMux
+//   -l logfile  Record relay transitions as "<ms> <state> +<closed> -<opened>"
+
+#define _GNU_SOURCE // posix_openpt() and friends
+
+#include "board.h"
+#include "presets.h"
+#include "scan.h"
+#include "usb_serial.h"
+#include "sim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <usbd_cdc.h>
+
+static int g_master = -1;
+static bool g_fast;
+static FILE *g_log;
+static const char *g_link;
+static uint64_t g_next_tick_ns; // Wall clock deadline of next tick
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void log_relays(uint32_t tick, uint32_t odr)
+{
+    static uint32_t prev;
+    uint32_t state = (odr >> RELAY_PIN_SHIFT) & RELAY_GPIO_MASK;
+
+    if (g_log && state != prev)
+    {
+        fprintf(g_log, "%u %02X +%02X -%02X\n", tick, state, state & ~prev, prev & ~state);
+        fflush(g_log);
+    }
+
+    prev = state;
+}
+
+static void send_to_host(uint8_t ep_addr, const uint8_t *data, size_t len)
+{
+    if (ep_addr != CDC_IN_EP)
+        return;
+
+    while (len > 0)
+    {
+        ssize_t n = write(g_master, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        data += n;
+        len -= n;
+    }
+}
+
+// Block until wall clock reaches next tick, unless in fast mode.
+static void wait_tick()
+{
+    if (g_fast)
+        return;
+
+    uint64_t now = now_ns();
+    if (g_next_tick_ns > now)
+    {
+        uint64_t delay = g_next_tick_ns - now;
+        struct timespec ts = {delay / 1000000000ULL, delay % 1000000000ULL};
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+    }
+
+    g_next_tick_ns += 1000000;
+}
+
+static void cleanup(int sig)
+{
+    if (g_link) unlink(g_link);
+    _exit(0);
+}
+
+static int open_pty()
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+    {
+        perror("posix_openpt");
+        exit(1);
+    }
+
+    const char *name = ptsname(master);
+
+    // Keep slave side open, so that the master does not report EOF
+    // between client connections.
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    if (g_link)
+    {
+        unlink(g_link);
+        if (symlink(name, g_link) < 0)
+        {
+            perror(g_link);
+            exit(1);
+        }
+    }
+
+    printf("%s\n", name);
+    fflush(stdout);
+    return master;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "fp:l:")) != -1)
+    {
+        if (opt == 'f')
+        {
+            g_fast = true;
+        }
+        else if (opt == 'p')
+        {
+            g_link = optarg;
+        }
+        else if (opt == 'l')
+        {
+            g_log = fopen(optarg, "w");
+            if (!g_log)
+            {
+                perror(optarg);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-f] [-p link] [-l logfile]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    g_master = open_pty();
+    signal(SIGINT, cleanup);
+    signal(SIGTERM, cleanup);
+
+    sim_gpioa_hook = log_relays;
+    sim_usb_transmit_hook = send_to_host;
+    sim_wfi_hook = wait_tick;
+
+    board_init();
+    set_relay_pwr(true);
+    usb_serial_start();
+
+    relay_mask_t power_on_state;
+    if (presets_init(&power_on_state))
+        relays_set_state(power_on_state, false);
+
+    static uint8_t rxbuf[256];
+    size_t rxlen = 0, rxpos = 0;
+    g_next_tick_ns = now_ns() + 1000000;
+
+    while (1)
+    {
+        // Feed host data until the device NAKs
+        if (rxpos < rxlen)
+        {
+            rxpos += sim_usb_receive(rxbuf + rxpos, rxlen - rxpos);
+        }
+
+        usb_serial_poll();
+        presets_poll();
+        while (sim_usb_service());
+
+        if (rxpos < rxlen)
+        {
+            // Device is still busy with earlier packets
+            continue;
+        }
+
+        bool busy = relays_busy() || scan_running();
+        int timeout;
+        if (g_fast)
+        {
+            timeout = busy ? 0 : -1;
+        }
+        else
+        {
+            uint64_t now = now_ns();
+            timeout = (g_next_tick_ns > now) ? (int)((g_next_tick_ns - now + 999999) / 1000000) : 0;
+        }
+
+        struct pollfd pfd = {.fd = g_master, .events = POLLIN};
+        if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN))
+        {
+            ssize_t n = read(g_master, rxbuf, sizeof(rxbuf));
+            if (n > 0)
+            {
+                rxlen = n;
+                rxpos = 0;
+            }
+            continue;
+        }
+
+        // Nothing from host, advance time
+        if (g_fast)
+        {
+            sim_tick();
+        }
+        else if (now_ns() >= g_next_tick_ns)
+        {
+            g_next_tick_ns += 1000000;
+            sim_tick();
+        }
+    }
+}
@@ -0,0 +1,42 @@
+// Host simulation of the relay mux hardware.
+// Time is virtual: it advances only through sim_tick(), which runs SysTick_Handler().
+// Firmware busy-waits call __WFI(), which completes pending USB transfers or advances time.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Advance simulated time by one millisecond
+void sim_tick(void);
+
+// Apply pending BSRR/BRR writes to ODR of all GPIO ports
+void sim_gpio_latch(void);
+
+// Signal an edge on an EXTI line, runs its handler if the line is unmasked
+void sim_exti(uint32_t line);
+
+// Called after every change of GPIOA outputs, may be NULL
+extern void (*sim_gpioa_hook)(uint32_t tick, uint32_t odr);
+
+// Called by __WFI() before it advances time by one tick, may be NULL.
+// Can be used to pace simulated time to wall clock.
+extern void (*sim_wfi_hook)(void);
+
+// Feed data from host to an OUT endpoint, split into 64-byte packets.
+// Returns number of bytes accepted; packets are NAKed while reception is not armed.
+size_t sim_usb_receive_ep(uint8_t ep_addr, const void *data, size_t len);
+
+// Feed data to the CDC data OUT endpoint
+size_t sim_usb_receive(const void *data, size_t len);
+
+// Complete pending IN transfers, like the USB interrupt would.
+// Returns true if any transfer completed.
+bool sim_usb_service(void);
+
+// While set, IN transfers stay pending as if the host stopped reading
+extern bool sim_usb_in_stalled;
+
+// Called for each packet sent on an IN endpoint, including zero-length packets, may be NULL
+extern void (*sim_usb_transmit_hook)(uint8_t ep_addr, const uint8_t *data, size_t len);
@@ -0,0 +1,169 @@
+// Host stand-in for the STM32F042 device header.
+// Peripherals are plain structs in RAM, see sim_hal.c.
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+    volatile uint32_t MODER;
+    volatile uint32_t OTYPER;
+    volatile uint32_t OSPEEDR;
+    volatile uint32_t PUPDR;
+    volatile uint32_t IDR;
+    volatile uint32_t ODR;
+    volatile uint32_t BSRR;
+    volatile uint32_t LCKR;
+    volatile uint32_t AFR[2];
+    volatile uint32_t BRR;
+} GPIO_TypeDef;
+
+typedef struct {
+    volatile uint32_t CR;
+    volatile uint32_t CFGR;
+    volatile uint32_t ISR;
+    volatile uint32_t ICR;
+} CRS_TypeDef;
+
+typedef struct {
+    volatile uint32_t CFGR1;
+    volatile uint32_t RESERVED;
+    volatile uint32_t EXTICR[4];
+    volatile uint32_t CFGR2;
+} SYSCFG_TypeDef;
+
+typedef struct {
+    volatile uint32_t CR1;
+    volatile uint32_t CR2;
+    volatile uint32_t SMCR;
+    volatile uint32_t DIER;
+    volatile uint32_t SR;
+    volatile uint32_t EGR;
+    volatile uint32_t CCMR1;
+    volatile uint32_t CCMR2;
+    volatile uint32_t CCER;
+    volatile uint32_t CNT;
+    volatile uint32_t PSC;
+    volatile uint32_t ARR;
+    volatile uint32_t RCR;
+    volatile uint32_t CCR1;
+    volatile uint32_t CCR2;
+    volatile uint32_t CCR3;
+    volatile uint32_t CCR4;
+    volatile uint32_t BDTR;
+    volatile uint32_t DCR;
+    volatile uint32_t DMAR;
+} TIM_TypeDef;
+
+typedef struct {
+    volatile uint32_t CR1;
+    volatile uint32_t CR2;
+    volatile uint32_t SR;
+    volatile uint32_t DR;
+    volatile uint32_t CRCPR;
+    volatile uint32_t RXCRCR;
+    volatile uint32_t TXCRCR;
+    volatile uint32_t I2SCFGR;
+    volatile uint32_t I2SPR;
+} SPI_TypeDef;
+
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t LOAD;
+    volatile uint32_t VAL;
+    volatile uint32_t CALIB;
+} SysTick_Type;
+
+typedef struct {
+    volatile uint32_t IMR;
+    volatile uint32_t EMR;
+    volatile uint32_t RTSR;
+    volatile uint32_t FTSR;
+    volatile uint32_t SWIER;
+    volatile uint32_t PR;
+} EXTI_TypeDef;
+
+typedef struct {
+    volatile uint32_t CPUID;
+    volatile uint32_t ICSR;
+    volatile uint32_t RESERVED0;
+    volatile uint32_t AIRCR;
+    volatile uint32_t SCR;
+    volatile uint32_t CCR;
+} SCB_TypeDef;
+
+extern GPIO_TypeDef g_sim_gpioa, g_sim_gpiob, g_sim_gpiof;
+extern CRS_TypeDef g_sim_crs;
+extern SYSCFG_TypeDef g_sim_syscfg;
+extern EXTI_TypeDef g_sim_exti;
+extern TIM_TypeDef g_sim_tim2, g_sim_tim3, g_sim_tim14;
+extern SPI_TypeDef g_sim_spi1;
+extern SysTick_Type g_sim_systick;
+extern SCB_TypeDef g_sim_scb;
+extern const uint32_t g_sim_uid[3];
+
+#define GPIOA   (&g_sim_gpioa)
+#define GPIOB   (&g_sim_gpiob)
+#define GPIOF   (&g_sim_gpiof)
+#define CRS     (&g_sim_crs)
+#define SYSCFG  (&g_sim_syscfg)
+#define EXTI    (&g_sim_exti)
+#define TIM2    (&g_sim_tim2)
+#define TIM3    (&g_sim_tim3)
+#define TIM14   (&g_sim_tim14)
+#define SPI1    (&g_sim_spi1)
+#define SysTick (&g_sim_systick)
+#define SCB     (&g_sim_scb)
+#define UID_BASE ((uintptr_t)g_sim_uid)
+#define FLASH_BASE 0x08000000U // Mapped by sim_hal.c at the same address
+#define FLASH_SIZE (32 * 1024)
+
+#define CRS_CR_CEN                  0x00000020U
+#define CRS_CR_AUTOTRIMEN           0x00000040U
+#define SYSCFG_CFGR1_PA11_PA12_RMP  0x00000010U
+#define SCB_ICSR_PENDSVSET_Msk      0x10000000U
+#define SCB_ICSR_PENDSTSET_Msk      0x04000000U
+#define TIM_CR1_CEN                 0x00000001U
+#define TIM_CR1_ARPE                0x00000080U
+#define TIM_EGR_UG                  0x00000001U
+#define TIM_CCMR1_OC1PE             0x00000008U
+#define TIM_CCMR1_OC1M_1            0x00000020U
+#define TIM_CCMR1_OC1M_2            0x00000040U
+#define TIM_CCMR1_OC2PE             0x00000800U
+#define TIM_CCMR1_OC2M_1            0x00002000U
+#define TIM_CCMR1_OC2M_2            0x00004000U
+#define TIM_CCMR2_OC3PE             0x00000008U
+#define TIM_CCMR2_OC3M_1            0x00000020U
+#define TIM_CCMR2_OC3M_2            0x00000040U
+#define TIM_CCMR2_OC4PE             0x00000800U
+#define TIM_CCMR2_OC4M_1            0x00002000U
+#define TIM_CCMR2_OC4M_2            0x00004000U
+#define TIM_CCER_CC1E               0x00000001U
+#define TIM_CCER_CC2E               0x00000010U
+#define TIM_CCER_CC3E               0x00000100U
+#define TIM_CCER_CC4E               0x00001000U
+#define SPI_CR1_MSTR                0x00000004U
+#define SPI_CR1_BR_0                0x00000008U
+#define SPI_CR1_SPE                 0x00000040U
+#define SPI_CR1_SSI                 0x00000100U
+#define SPI_CR1_SSM                 0x00000200U
+#define SPI_CR2_DS_0                0x00000100U
+#define SPI_CR2_DS_1                0x00000200U
+#define SPI_CR2_DS_2                0x00000400U
+#define SPI_CR2_FRXTH               0x00001000U
+#define SPI_SR_TXE                  0x00000002U
+#define SPI_SR_BSY                  0x00000080U
+
+typedef enum {
+    PendSV_IRQn = -2,
+    SysTick_IRQn = -1,
+    EXTI0_1_IRQn = 5,
+    USB_IRQn = 31,
+} IRQn_Type;
+
+// Interrupts are simulated synchronously, see sim_hal.c
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __WFI(void);
@@ -0,0 +1,119 @@
+// Host stand-in for the subset of STM32Cube HAL used by the firmware.
+
+#pragma once
+
+#include "stm32f042x6.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum {
+    HAL_OK = 0,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+#define GPIO_PIN_0      0x0001U
+#define GPIO_PIN_1      0x0002U
+#define GPIO_PIN_2      0x0004U
+#define GPIO_PIN_3      0x0008U
+#define GPIO_PIN_4      0x0010U
+#define GPIO_PIN_5      0x0020U
+#define GPIO_PIN_6      0x0040U
+#define GPIO_PIN_7      0x0080U
+#define GPIO_PIN_8      0x0100U
+#define GPIO_PIN_11     0x0800U
+#define GPIO_PIN_12     0x1000U
+#define GPIO_PIN_15     0x8000U
+
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+#define GPIO_MODE_INPUT         0x00U
+#define GPIO_MODE_OUTPUT_PP     0x01U
+#define GPIO_MODE_AF_PP         0x02U
+#define GPIO_MODE_ANALOG        0x03U
+
+#define GPIO_NOPULL             0x00U
+#define GPIO_PULLUP             0x01U
+#define GPIO_PULLDOWN           0x02U
+
+#define GPIO_SPEED_LOW          0x00U
+#define GPIO_SPEED_HIGH         0x03U
+#define GPIO_SPEED_FREQ_HIGH    0x03U
+
+#define GPIO_AF0_SPI1           0x00U
+#define GPIO_AF1_TIM3           0x01U
+#define GPIO_AF2_TIM2           0x02U
+#define GPIO_AF2_USB            0x02U
+#define GPIO_AF4_TIM14          0x04U
+
+typedef struct {
+    uint32_t Pin;
+    uint32_t Mode;
+    uint32_t Pull;
+    uint32_t Speed;
+    uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+#define RCC_OSCILLATORTYPE_HSI48    0x20U
+#define RCC_HSI48_ON                0x01U
+#define RCC_CLOCKTYPE_SYSCLK        0x01U
+#define RCC_CLOCKTYPE_HCLK          0x02U
+#define RCC_CLOCKTYPE_PCLK1         0x04U
+#define RCC_SYSCLKSOURCE_HSI48      0x03U
+#define RCC_SYSCLK_DIV1             0x00U
+#define RCC_HCLK_DIV2               0x04U
+#define FLASH_LATENCY_1             0x01U
+
+typedef struct {
+    uint32_t OscillatorType;
+    uint32_t HSI48State;
+} RCC_OscInitTypeDef;
+
+typedef struct {
+    uint32_t ClockType;
+    uint32_t SYSCLKSource;
+    uint32_t AHBCLKDivider;
+    uint32_t APB1CLKDivider;
+} RCC_ClkInitTypeDef;
+
+#define __HAL_RCC_GPIOA_CLK_ENABLE()    do {} while (0)
+#define __HAL_RCC_GPIOB_CLK_ENABLE()    do {} while (0)
+#define __HAL_RCC_GPIOF_CLK_ENABLE()    do {} while (0)
+#define __HAL_RCC_CRS_CLK_ENABLE()      do {} while (0)
+#define __HAL_RCC_SYSCFG_CLK_ENABLE()   do {} while (0)
+#define __HAL_RCC_TIM2_CLK_ENABLE()     do {} while (0)
+#define __HAL_RCC_TIM3_CLK_ENABLE()     do {} while (0)
+#define __HAL_RCC_TIM14_CLK_ENABLE()    do {} while (0)
+#define __HAL_RCC_SPI1_CLK_ENABLE()     do {} while (0)
+
+#define FLASH_PAGE_SIZE             0x400U
+#define FLASH_TYPEERASE_PAGES       0x00U
+#define FLASH_TYPEPROGRAM_HALFWORD  0x01U
+
+typedef struct {
+    uint32_t TypeErase;
+    uint32_t PageAddress;
+    uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+HAL_StatusTypeDef HAL_Init(void);
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *init);
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *init, uint32_t latency);
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init);
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t preempt, uint32_t sub);
+void HAL_NVIC_EnableIRQ(IRQn_Type irq);
+void HAL_NVIC_DisableIRQ(IRQn_Type irq);
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t address, uint64_t data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *init, uint32_t *page_error);
+
+void HAL_IncTick(void);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t delay);
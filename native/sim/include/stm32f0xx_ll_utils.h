@@ -0,0 +1,7 @@
+// Host stand-in for STM32Cube LL utilities.
+
+#pragma once
+
+#include <stdint.h>
+
+void LL_mDelay(uint32_t delay);
@@ -0,0 +1,39 @@
+// Host stand-in for STM32 USB device library CDC class.
+// Packets are exchanged with the host program through sim.h.
+
+#pragma once
+
+#include "usbd_core.h"
+
+#define CDC_IN_EP                   0x81U
+#define CDC_OUT_EP                  0x01U
+#define CDC_CMD_EP                  0x82U
+#define CDC_DATA_FS_MAX_PACKET_SIZE 64U
+#define CDC_CMD_PACKET_SIZE         8U
+
+typedef struct {
+    int8_t (*Init)(void);
+    int8_t (*DeInit)(void);
+    int8_t (*Control)(uint8_t cmd, uint8_t *pbuf, uint16_t length);
+    int8_t (*Receive)(uint8_t *buf, uint32_t *len);
+} USBD_CDC_ItfTypeDef;
+
+typedef struct {
+    uint32_t data[CDC_DATA_FS_MAX_PACKET_SIZE / 4U];
+    uint8_t CmdOpCode;
+    uint8_t CmdLength;
+    uint8_t *RxBuffer;
+    uint8_t *TxBuffer;
+    uint32_t RxLength;
+    uint32_t TxLength;
+    volatile uint32_t TxState;
+    volatile uint32_t RxState;
+} USBD_CDC_HandleTypeDef;
+
+extern USBD_ClassTypeDef USBD_CDC;
+
+uint8_t USBD_CDC_RegisterInterface(USBD_HandleTypeDef *pdev, USBD_CDC_ItfTypeDef *fops);
+uint8_t USBD_CDC_SetTxBuffer(USBD_HandleTypeDef *pdev, uint8_t *pbuff, uint32_t length);
+uint8_t USBD_CDC_SetRxBuffer(USBD_HandleTypeDef *pdev, uint8_t *pbuff);
+uint8_t USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev);
+uint8_t USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev);
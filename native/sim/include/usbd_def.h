@@ -0,0 +1,89 @@
+// Host stand-in for STM32 USB device library definitions.
+
+#pragma once
+
+#include "usbd_conf.h"
+#include <stdint.h>
+
+#define USBD_OK     0U
+#define USBD_BUSY   1U
+#define USBD_FAIL   2U
+
+#define USB_DESC_TYPE_DEVICE        0x01U
+#define USB_DESC_TYPE_CONFIGURATION 0x02U
+#define USB_DESC_TYPE_STRING        0x03U
+#define USB_DESC_TYPE_INTERFACE     0x04U
+#define USB_DESC_TYPE_ENDPOINT      0x05U
+#define USB_LEN_LANGID_STR_DESC     0x04U
+#define USB_MAX_EP0_SIZE            64U
+
+#define USBD_IDX_MFC_STR            0x01U
+#define USBD_IDX_PRODUCT_STR        0x02U
+#define USBD_IDX_SERIAL_STR         0x03U
+
+typedef enum {
+    USBD_SPEED_HIGH = 0,
+    USBD_SPEED_FULL = 1,
+} USBD_SpeedTypeDef;
+
+typedef struct {
+    uint8_t *(*GetDeviceDescriptor)(USBD_SpeedTypeDef speed, uint16_t *length);
+    uint8_t *(*GetLangIDStrDescriptor)(USBD_SpeedTypeDef speed, uint16_t *length);
+    uint8_t *(*GetManufacturerStrDescriptor)(USBD_SpeedTypeDef speed, uint16_t *length);
+    uint8_t *(*GetProductStrDescriptor)(USBD_SpeedTypeDef speed, uint16_t *length);
+    uint8_t *(*GetSerialStrDescriptor)(USBD_SpeedTypeDef speed, uint16_t *length);
+    uint8_t *(*GetConfigurationStrDescriptor)(USBD_SpeedTypeDef speed, uint16_t *length);
+    uint8_t *(*GetInterfaceStrDescriptor)(USBD_SpeedTypeDef speed, uint16_t *length);
+} USBD_DescriptorsTypeDef;
+
+#define USBD_STATE_DEFAULT          0x01U
+#define USBD_STATE_ADDRESSED        0x02U
+#define USBD_STATE_CONFIGURED       0x03U
+#define USBD_STATE_SUSPENDED        0x04U
+
+#define USBD_EP_TYPE_CTRL           0x00U
+#define USBD_EP_TYPE_ISOC           0x01U
+#define USBD_EP_TYPE_BULK           0x02U
+#define USBD_EP_TYPE_INTR           0x03U
+
+typedef struct {
+    uint8_t bmRequest;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} USBD_SetupReqTypedef;
+
+struct _USBD_HandleTypeDef;
+
+typedef struct {
+    uint8_t (*Init)(struct _USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+    uint8_t (*DeInit)(struct _USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+    uint8_t (*Setup)(struct _USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+    uint8_t (*EP0_TxSent)(struct _USBD_HandleTypeDef *pdev);
+    uint8_t (*EP0_RxReady)(struct _USBD_HandleTypeDef *pdev);
+    uint8_t (*DataIn)(struct _USBD_HandleTypeDef *pdev, uint8_t epnum);
+    uint8_t (*DataOut)(struct _USBD_HandleTypeDef *pdev, uint8_t epnum);
+    uint8_t (*SOF)(struct _USBD_HandleTypeDef *pdev);
+    uint8_t (*IsoINIncomplete)(struct _USBD_HandleTypeDef *pdev, uint8_t epnum);
+    uint8_t (*IsoOUTIncomplete)(struct _USBD_HandleTypeDef *pdev, uint8_t epnum);
+    uint8_t *(*GetHSConfigDescriptor)(uint16_t *length);
+    uint8_t *(*GetFSConfigDescriptor)(uint16_t *length);
+    uint8_t *(*GetOtherSpeedConfigDescriptor)(uint16_t *length);
+    uint8_t *(*GetDeviceQualifierDescriptor)(uint16_t *length);
+} USBD_ClassTypeDef;
+
+typedef struct _USBD_HandleTypeDef {
+    uint8_t id;
+    volatile uint8_t dev_state;
+    USBD_DescriptorsTypeDef *pDesc;
+    USBD_ClassTypeDef *pClass;
+    void *pClassData;
+    void *pUserData;
+    void *pData;
+} USBD_HandleTypeDef;
+
+void USBD_GetString(uint8_t *desc, uint8_t *unicode, uint16_t *len);
+uint8_t USBD_Init(USBD_HandleTypeDef *pdev, USBD_DescriptorsTypeDef *pdesc, uint8_t id);
+uint8_t USBD_RegisterClass(USBD_HandleTypeDef *pdev, USBD_ClassTypeDef *pclass);
+uint8_t USBD_Start(USBD_HandleTypeDef *pdev);
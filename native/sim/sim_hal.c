@@ -0,0 +1,224 @@
+// Simulated STM32 peripherals and HAL for host builds.
+
+#include "sim.h"
+#include <stm32f0xx_hal.h>
+#include <stm32f0xx_ll_utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+GPIO_TypeDef g_sim_gpioa, g_sim_gpiob, g_sim_gpiof;
+CRS_TypeDef g_sim_crs;
+SYSCFG_TypeDef g_sim_syscfg;
+EXTI_TypeDef g_sim_exti;
+TIM_TypeDef g_sim_tim2, g_sim_tim3, g_sim_tim14;
+SPI_TypeDef g_sim_spi1 = {.SR = SPI_SR_TXE}; // Transfers complete instantly
+SysTick_Type g_sim_systick = {.LOAD = 47999, .VAL = 47999}; // Always at start of tick
+SCB_TypeDef g_sim_scb;  // Pended PendSV is ignored, drivers poll directly
+const uint32_t g_sim_uid[3] = {0x00350042, 0x31345111, 0x20363236};
+
+void (*sim_gpioa_hook)(uint32_t tick, uint32_t odr);
+void (*sim_wfi_hook)(void);
+
+static volatile uint32_t g_sim_tickcount;
+static bool g_sim_flash_unlocked;
+
+void SysTick_Handler();
+void EXTI0_1_IRQHandler();
+
+static void latch_port(GPIO_TypeDef *port)
+{
+    uint32_t odr = port->ODR;
+    odr |= port->BSRR & 0xFFFF;
+    odr &= ~(port->BSRR >> 16);
+    odr &= ~(port->BRR & 0xFFFF);
+    port->BSRR = 0;
+    port->BRR = 0;
+
+    if (odr != port->ODR)
+    {
+        port->ODR = odr;
+        if (port == GPIOA && sim_gpioa_hook)
+        {
+            sim_gpioa_hook(g_sim_tickcount, odr);
+        }
+    }
+}
+
+void sim_gpio_latch(void)
+{
+    latch_port(GPIOA);
+    latch_port(GPIOB);
+    latch_port(GPIOF);
+}
+
+void sim_exti(uint32_t line)
+{
+    g_sim_exti.PR |= 1 << line;
+    if (line <= 1 && (g_sim_exti.IMR & (1 << line)))
+    {
+        EXTI0_1_IRQHandler();
+        sim_gpio_latch();
+    }
+}
+
+void sim_tick(void)
+{
+    SysTick_Handler();
+    sim_gpio_latch();
+}
+
+void __disable_irq(void)
+{
+}
+
+void __enable_irq(void)
+{
+    sim_gpio_latch();
+}
+
+uint32_t __get_PRIMASK(void)
+{
+    return 0;
+}
+
+void __set_PRIMASK(uint32_t primask)
+{
+    if (!primask)
+        __enable_irq();
+}
+
+void __WFI(void)
+{
+    // Wake up on USB interrupt if a transfer is pending, otherwise on SysTick
+    if (!sim_usb_service())
+    {
+        if (sim_wfi_hook)
+            sim_wfi_hook();
+
+        sim_tick();
+    }
+}
+
+// Flash is read through pointers to its device address, so map memory there
+__attribute__((constructor))
+static void sim_flash_map(void)
+{
+    void *flash = mmap((void *)(uintptr_t)FLASH_BASE, FLASH_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (flash != (void *)(uintptr_t)FLASH_BASE)
+    {
+        perror("sim: mapping flash");
+        exit(1);
+    }
+
+    memset(flash, 0xFF, FLASH_SIZE);
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+    g_sim_flash_unlocked = true;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+    g_sim_flash_unlocked = false;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t address, uint64_t data)
+{
+    volatile uint16_t *p = (volatile uint16_t *)(uintptr_t)address;
+
+    if (!g_sim_flash_unlocked || type != FLASH_TYPEPROGRAM_HALFWORD || (address & 1) ||
+        address < FLASH_BASE || address >= FLASH_BASE + FLASH_SIZE)
+        return HAL_ERROR;
+
+    // Like the flash controller, only erased halfwords can be programmed
+    if (*p != 0xFFFF && (uint16_t)data != 0)
+        return HAL_ERROR;
+
+    *p = (uint16_t)data;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *init, uint32_t *page_error)
+{
+    uint32_t start = init->PageAddress & ~(FLASH_PAGE_SIZE - 1);
+    uint32_t size = init->NbPages * FLASH_PAGE_SIZE;
+
+    *page_error = 0xFFFFFFFF;
+    if (!g_sim_flash_unlocked || init->TypeErase != FLASH_TYPEERASE_PAGES ||
+        start < FLASH_BASE || start + size > FLASH_BASE + FLASH_SIZE)
+        return HAL_ERROR;
+
+    memset((void *)(uintptr_t)start, 0xFF, size);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_Init(void)
+{
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *init)
+{
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *init, uint32_t latency)
+{
+    return HAL_OK;
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init)
+{
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+{
+    if (state)
+        port->BSRR = pin;
+    else
+        port->BRR = pin;
+
+    sim_gpio_latch();
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t preempt, uint32_t sub)
+{
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type irq)
+{
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type irq)
+{
+}
+
+void HAL_IncTick(void)
+{
+    g_sim_tickcount++;
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return g_sim_tickcount;
+}
+
+void HAL_Delay(uint32_t delay)
+{
+    uint32_t start = HAL_GetTick();
+    while ((uint32_t)(HAL_GetTick() - start) <= delay)
+    {
+        sim_tick();
+    }
+}
+
+void LL_mDelay(uint32_t delay)
+{
+    HAL_Delay(delay);
+}
@@ -0,0 +1,228 @@
+// Simulated USB device for host builds.
+// Models endpoint arming, 64-byte packetization and the NAK behaviour of
+// OUT endpoints, and completes IN transfers through the class DataIn callback.
+
+#include "sim.h"
+#include <usbd_cdc.h>
+#include <string.h>
+
+#define SIM_USB_EPS 8
+#define SIM_USB_MPS 64
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t len;
+    bool busy;
+} sim_usb_ep_t;
+
+void (*sim_usb_transmit_hook)(uint8_t ep_addr, const uint8_t *data, size_t len);
+
+static USBD_HandleTypeDef *g_sim_pdev;
+static sim_usb_ep_t g_sim_ep_in[SIM_USB_EPS];
+static sim_usb_ep_t g_sim_ep_out[SIM_USB_EPS];
+
+/* Subset of the STM32 CDC class */
+
+static USBD_CDC_HandleTypeDef g_sim_cdc;
+
+static uint8_t SimCDC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+    memset(&g_sim_cdc, 0, sizeof(g_sim_cdc));
+    pdev->pClassData = &g_sim_cdc;
+    ((USBD_CDC_ItfTypeDef*)pdev->pUserData)->Init();
+    USBD_LL_PrepareReceive(pdev, CDC_OUT_EP, g_sim_cdc.RxBuffer, CDC_DATA_FS_MAX_PACKET_SIZE);
+    return USBD_OK;
+}
+
+static uint8_t SimCDC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+    g_sim_cdc.TxState = 0;
+    return USBD_OK;
+}
+
+static uint8_t SimCDC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+    g_sim_cdc.RxLength = USBD_LL_GetRxDataSize(pdev, epnum);
+    ((USBD_CDC_ItfTypeDef*)pdev->pUserData)->Receive(g_sim_cdc.RxBuffer, &g_sim_cdc.RxLength);
+    return USBD_OK;
+}
+
+static uint8_t SimCDC_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+    return USBD_OK;
+}
+
+USBD_ClassTypeDef USBD_CDC = {
+    .Init = SimCDC_Init,
+    .DeInit = SimCDC_DeInit,
+    .DataIn = SimCDC_DataIn,
+    .DataOut = SimCDC_DataOut,
+};
+
+uint8_t USBD_CDC_RegisterInterface(USBD_HandleTypeDef *pdev, USBD_CDC_ItfTypeDef *fops)
+{
+    pdev->pUserData = fops;
+    return USBD_OK;
+}
+
+uint8_t USBD_CDC_SetTxBuffer(USBD_HandleTypeDef *pdev, uint8_t *pbuff, uint32_t length)
+{
+    g_sim_cdc.TxBuffer = pbuff;
+    g_sim_cdc.TxLength = length;
+    return USBD_OK;
+}
+
+uint8_t USBD_CDC_SetRxBuffer(USBD_HandleTypeDef *pdev, uint8_t *pbuff)
+{
+    g_sim_cdc.RxBuffer = pbuff;
+    return USBD_OK;
+}
+
+uint8_t USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev)
+{
+    return USBD_LL_PrepareReceive(pdev, CDC_OUT_EP, g_sim_cdc.RxBuffer, CDC_DATA_FS_MAX_PACKET_SIZE);
+}
+
+uint8_t USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev)
+{
+    if (g_sim_cdc.TxState != 0)
+        return USBD_BUSY;
+
+    g_sim_cdc.TxState = 1;
+    return USBD_LL_Transmit(pdev, CDC_IN_EP, g_sim_cdc.TxBuffer, g_sim_cdc.TxLength);
+}
+
+/* Device core */
+
+void USBD_GetString(uint8_t *desc, uint8_t *unicode, uint16_t *len)
+{
+    size_t n = strlen((const char*)desc);
+    *len = 2 + n * 2;
+    unicode[0] = *len;
+    unicode[1] = USB_DESC_TYPE_STRING;
+    for (size_t i = 0; i < n; i++)
+    {
+        unicode[2 + i * 2] = desc[i];
+        unicode[3 + i * 2] = 0;
+    }
+}
+
+uint8_t USBD_Init(USBD_HandleTypeDef *pdev, USBD_DescriptorsTypeDef *pdesc, uint8_t id)
+{
+    memset(pdev, 0, sizeof(*pdev));
+    pdev->pDesc = pdesc;
+    pdev->dev_state = USBD_STATE_DEFAULT;
+    g_sim_pdev = pdev;
+    return USBD_OK;
+}
+
+uint8_t USBD_RegisterClass(USBD_HandleTypeDef *pdev, USBD_ClassTypeDef *pclass)
+{
+    pdev->pClass = pclass;
+    return USBD_OK;
+}
+
+uint8_t USBD_Start(USBD_HandleTypeDef *pdev)
+{
+    // Simulated host enumerates and configures the device immediately
+    pdev->dev_state = USBD_STATE_CONFIGURED;
+    return pdev->pClass->Init(pdev, 1);
+}
+
+/* Low level driver */
+
+uint8_t USBD_LL_OpenEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t ep_type, uint16_t ep_mps)
+{
+    return USBD_OK;
+}
+
+uint8_t USBD_LL_CloseEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    sim_usb_ep_t *ep = (ep_addr & 0x80) ? &g_sim_ep_in[ep_addr & 0x7F] : &g_sim_ep_out[ep_addr];
+    ep->busy = false;
+    return USBD_OK;
+}
+
+uint8_t USBD_LL_Transmit(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t *pbuf, uint16_t size)
+{
+    sim_usb_ep_t *ep = &g_sim_ep_in[ep_addr & 0x7F];
+    ep->buf = pbuf;
+    ep->len = size;
+    ep->busy = true;
+    return USBD_OK;
+}
+
+uint8_t USBD_LL_PrepareReceive(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t *pbuf, uint16_t size)
+{
+    sim_usb_ep_t *ep = &g_sim_ep_out[ep_addr];
+    ep->buf = pbuf;
+    ep->len = 0;
+    ep->busy = true;
+    return USBD_OK;
+}
+
+uint32_t USBD_LL_GetRxDataSize(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+    return g_sim_ep_out[ep_addr & 0x7F].len;
+}
+
+/* Simulated host side */
+
+size_t sim_usb_receive_ep(uint8_t ep_addr, const void *data, size_t len)
+{
+    sim_usb_ep_t *ep = &g_sim_ep_out[ep_addr];
+    size_t pos = 0;
+    while (pos < len && ep->busy)
+    {
+        uint32_t pkt = len - pos;
+        if (pkt > SIM_USB_MPS) pkt = SIM_USB_MPS;
+
+        // Reception has to be re-armed after each packet
+        ep->busy = false;
+        ep->len = pkt;
+        memcpy(ep->buf, (const uint8_t*)data + pos, pkt);
+        pos += pkt;
+        g_sim_pdev->pClass->DataOut(g_sim_pdev, ep_addr);
+    }
+
+    return pos;
+}
+
+size_t sim_usb_receive(const void *data, size_t len)
+{
+    return sim_usb_receive_ep(CDC_OUT_EP, data, len);
+}
+
+bool sim_usb_in_stalled;
+
+bool sim_usb_service(void)
+{
+    bool completed = false;
+    if (sim_usb_in_stalled)
+        return false;
+
+    for (uint8_t i = 0; i < SIM_USB_EPS; i++)
+    {
+        sim_usb_ep_t *ep = &g_sim_ep_in[i];
+        if (!ep->busy) continue;
+
+        // Packetize like the hardware, a multiple of 64 bytes is not terminated automatically
+        uint32_t pos = 0;
+        do
+        {
+            uint32_t pkt = ep->len - pos;
+            if (pkt > SIM_USB_MPS) pkt = SIM_USB_MPS;
+            if (sim_usb_transmit_hook)
+            {
+                sim_usb_transmit_hook(0x80 | i, ep->buf + pos, pkt);
+            }
+            pos += pkt;
+        } while (pos < ep->len);
+
+        ep->busy = false;
+        completed = true;
+        g_sim_pdev->pClass->DataIn(g_sim_pdev, i);
+    }
+
+    return completed;
+}
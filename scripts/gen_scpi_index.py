@@ -0,0 +1,240 @@
+# Generate the command header index used by src/scpi_dispatch.c from the
+# patterns in g_scpi_commands, src/scpi_commands.c.
+#
+# The index is a trie of header mnemonics. Optional nodes such as [ROUTe] are
+# expanded into both paths, and identical subtrees are stored once, so that
+# CLOSe under the root and under ROUTe is the same node. Children of a node
+# are sorted by short form for binary search. The table is rejected if any
+# header could match two of its patterns.
+#
+# Runs as a PlatformIO pre-script, writing scpi_index.h into the build
+# directory, or by hand: gen_scpi_index.py src/scpi_commands.c scpi_index.h
+
+import os
+import re
+import sys
+
+TABLE_START = re.compile(r"const\s+scpi_command_t\s+g_scpi_commands\s*\[\s*\]\s*=\s*\{")
+ENTRY_PATTERN = re.compile(r'\{\s*(?:\.pattern\s*=\s*)?"([^"]*)"')
+
+
+class TableError(Exception):
+    pass
+
+
+def read_patterns(source):
+    match = TABLE_START.search(source)
+    if not match:
+        raise TableError("g_scpi_commands not found")
+    end = source.index("SCPI_CMD_LIST_END", match.end())
+    body = re.sub(r"/\*.*?\*/|//[^\n]*", "", source[match.end():end], flags=re.S)
+
+    if re.search(r"^\s*#", body, flags=re.M):
+        raise TableError("preprocessor lines in g_scpi_commands are not supported")
+
+    patterns = ENTRY_PATTERN.findall(body)
+    if len(patterns) != body.count("{"):
+        raise TableError("g_scpi_commands entry without a string pattern")
+    return patterns
+
+
+def short_form(name):
+    i = 0
+    while i < len(name) and not name[i].islower():
+        i += 1
+    return name[:i]
+
+
+def split_pattern(pattern):
+    """Nodes of a pattern as (name, optional), and whether it is a query"""
+    query = pattern.endswith("?")
+    if query:
+        pattern = pattern[:-1]
+    if pattern.startswith("*"):
+        return [(pattern, False)], query
+
+    nodes = []
+    pos = 0
+    for match in re.finditer(r"(\[?):?([^:\[\]]+)(\]?)", pattern):
+        if match.start() != pos or bool(match.group(1)) != bool(match.group(3)):
+            raise TableError("unsupported pattern '%s'" % pattern)
+        nodes.append((match.group(2), bool(match.group(1))))
+        pos = match.end()
+    if pos != len(pattern):
+        raise TableError("unsupported pattern '%s'" % pattern)
+    for name, _ in nodes:
+        if len(short_form(name)) == 0 or not re.fullmatch(r"[A-Za-z0-9_]+", name):
+            raise TableError("unsupported node '%s' in '%s'" % (name, pattern))
+    return nodes, query
+
+
+def expand(nodes):
+    """All node name paths a pattern accepts"""
+    paths = [[]]
+    for name, optional in nodes:
+        paths = [p + [name] for p in paths] + (paths if optional else [])
+    return paths
+
+
+class Node:
+    def __init__(self, name):
+        self.name = name
+        self.children = {}  # short form -> Node
+        self.command = -1
+        self.query = -1
+
+
+def build_trie(patterns):
+    root = Node("")
+    for index, pattern in enumerate(patterns):
+        nodes, query = split_pattern(pattern)
+        for path in expand(nodes):
+            node = root
+            for name in path:
+                key = short_form(name).upper()
+                child = node.children.get(key)
+                if child is None:
+                    child = node.children[key] = Node(name)
+                elif child.name.upper() != name.upper():
+                    raise TableError("'%s' and '%s' share short form %s" % (child.name, name, key))
+                node = child
+
+            slot = "query" if query else "command"
+            other = getattr(node, slot)
+            if other >= 0 and other != index:
+                raise TableError("'%s' matches both '%s' and '%s'" %
+                                  (":".join(path) + ("?" if query else ""), patterns[other], pattern))
+            setattr(node, slot, index)
+    return root
+
+
+def check_siblings(node, path=""):
+    keys = sorted(node.children)
+    for a, b in zip(keys, keys[1:]):
+        if b.startswith(a):
+            raise TableError("short form %s is a prefix of %s under '%s'" % (a, b, path))
+    for key in keys:
+        check_siblings(node.children[key], path + ":" + key)
+
+
+def layout(root):
+    """Flatten into node and child tables, sharing identical subtrees"""
+    nodes = []      # (name, children offset, child count, command, query, comment)
+    children = []
+    shared = {}
+
+    def place(node, path):
+        child_ids = [place(node.children[key], path + [node.children[key].name])
+                     for key in sorted(node.children)]
+        signature = (node.name.upper(), node.command, node.query, tuple(child_ids))
+        if signature in shared:
+            return shared[signature]
+
+        # Reuse an equal run of children, e.g. of nodes differing only in name
+        offset = 0
+        if child_ids:
+            runs = [i for i in range(len(children) - len(child_ids) + 1)
+                    if children[i:i + len(child_ids)] == child_ids]
+            if runs:
+                offset = runs[0]
+            else:
+                offset = len(children)
+                children.extend(child_ids)
+
+        nodes.append((node.name, offset, len(child_ids), node.command, node.query, ":".join(path)))
+        shared[signature] = len(nodes) - 1
+        return len(nodes) - 1
+
+    place(root, [])
+
+    # Root first, the lookup starts there
+    order = [len(nodes) - 1] + list(range(len(nodes) - 1))
+    renumber = {old: new for new, old in enumerate(order)}
+    nodes = [nodes[i] for i in order]
+    children = [renumber[c] for c in children]
+    return nodes, children
+
+
+def generate(source_path):
+    with open(source_path) as f:
+        patterns = read_patterns(f.read())
+
+    root = build_trie(patterns)
+    check_siblings(root)
+    nodes, children = layout(root)
+
+    if len(patterns) > 127 or len(nodes) > 256 or len(children) > 256:
+        raise TableError("index does not fit in its 8-bit fields")
+
+    # Mnemonics in upper case, each stored once in one string
+    names = ""
+    offsets = []
+    for name, *_ in nodes:
+        offset = names.find(name.upper())
+        if offset < 0:
+            offset = len(names)
+            names += name.upper()
+        offsets.append(offset)
+    if len(names) > 0xFFFF:
+        raise TableError("mnemonics do not fit in 16-bit offsets")
+
+    out = []
+    out.append("// Generated by scripts/gen_scpi_index.py from g_scpi_commands, do not edit.")
+    out.append("// %d commands, %d nodes." % (len(patterns), len(nodes)))
+    out.append("")
+    out.append("static const char g_scpi_index_names[] =")
+    for i in range(0, len(names), 64):
+        out.append('    "%s"' % names[i:i + 64])
+    out[-1] += ";"
+    out.append("")
+    out.append("static const scpi_index_node_t g_scpi_index[] = {")
+    for i, (name, offset, count, command, query, comment) in enumerate(nodes):
+        out.append("    {%d, %d, %d, %d, %d, %d, %d}, // %d %s" % (
+            offsets[i], len(short_form(name)), len(name), offset, count, command, query, i,
+            comment or "(root)"))
+    out.append("};")
+    out.append("")
+    out.append("static const uint8_t g_scpi_index_children[] = {")
+    for i in range(0, len(children), 16):
+        out.append("    " + ", ".join(str(c) for c in children[i:i + 16]) + ",")
+    out.append("};")
+    return "\n".join(out) + "\n"
+
+
+def write_if_changed(path, text):
+    try:
+        with open(path) as f:
+            if f.read() == text:
+                return
+    except OSError:
+        pass
+    with open(path, "w") as f:
+        f.write(text)
+
+
+def main(args):
+    if len(args) != 2:
+        sys.stderr.write("Usage: gen_scpi_index.py <scpi_commands.c> <output.h>\n")
+        return 2
+    try:
+        write_if_changed(args[1], generate(args[0]))
+    except TableError as e:
+        sys.stderr.write("%s: %s\n" % (args[0], e))
+        return 1
+    return 0
+
+
+try:
+    Import("env")  # Defined when run by PlatformIO
+except NameError:
+    sys.exit(main(sys.argv[1:]))
+else:
+    out_dir = os.path.join(env.subst("$BUILD_DIR"), "generated")
+    os.makedirs(out_dir, exist_ok=True)
+    source = os.path.join(env.subst("$PROJECT_SRC_DIR"), "scpi_commands.c")
+    try:
+        write_if_changed(os.path.join(out_dir, "scpi_index.h"), generate(source))
+    except TableError as e:
+        sys.stderr.write("%s: %s\n" % (source, e))
+        env.Exit(1)
+    env.Append(CPPPATH=[out_dir])
@@ -0,0 +1,46 @@
+#include "binary_control.h"
+#include "board.h"
+#include "scpi_commands.h"
+
+void binctrl_execute(const binctrl_request_t *req, binctrl_ack_t *ack)
+{
+    ack->opcode = req->opcode;
+    ack->status = BINCTRL_STATUS_OK;
+    ack->seq = req->seq;
+    ack->timestamp = HAL_GetTick();
+
+    switch (req->opcode)
+    {
+        case BINCTRL_OP_NOP:
+        case BINCTRL_OP_GET_STATE:
+            break;
+
+        case BINCTRL_OP_SET_BBM:
+        case BINCTRL_OP_SET_MBB:
+        {
+            relay_mask_t target = (relays_get_state() & ~(relay_mask_t)UINT32_MAX) | req->mask;
+            if (scpi_route_transaction_open())
+                ack->status = BINCTRL_STATUS_TRANSACTION;
+            else if (req->mask & ~RELAY_MASK)
+                ack->status = BINCTRL_STATUS_BAD_MASK;
+            else if (!mux_state_valid(target))
+                ack->status = BINCTRL_STATUS_CONFLICT;
+            else
+                relays_set_state(target, req->opcode == BINCTRL_OP_SET_MBB);
+            break;
+        }
+
+        case BINCTRL_OP_OPEN_ALL:
+            if (scpi_route_transaction_open())
+                ack->status = BINCTRL_STATUS_TRANSACTION;
+            else
+                open_relays(RELAY_MASK);
+            break;
+
+        default:
+            ack->status = BINCTRL_STATUS_BAD_OPCODE;
+            break;
+    }
+
+    ack->state = relays_get_state();
+}
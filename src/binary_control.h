@@ -0,0 +1,42 @@
+// Binary control protocol for the vendor-specific USB interface.
+// Each OUT packet carries one or more fixed-size request frames, and one ack
+// frame is returned for each request on the IN endpoint. All fields are little-endian.
+// Masks cover channels 1..32. On boards with more channels, SET operations
+// leave the channels above 32 as they are.
+
+#pragma once
+
+#include <stdint.h>
+
+#define BINCTRL_REQUEST_SIZE 8
+#define BINCTRL_ACK_SIZE     12
+
+#define BINCTRL_OP_NOP          0x00 // Only acknowledge
+#define BINCTRL_OP_SET_BBM      0x01 // Set channel mask, break-before-make
+#define BINCTRL_OP_SET_MBB      0x02 // Set channel mask, make-before-break
+#define BINCTRL_OP_GET_STATE    0x03 // Only report state
+#define BINCTRL_OP_OPEN_ALL     0x04 // Open all channels
+
+#define BINCTRL_STATUS_OK           0x00
+#define BINCTRL_STATUS_BAD_OPCODE   0x01
+#define BINCTRL_STATUS_BAD_MASK     0x02
+#define BINCTRL_STATUS_CONFLICT     0x03 // Mask violates exclusive mux mode
+#define BINCTRL_STATUS_TRANSACTION  0x04 // SCPI ROUTe:BEGin transaction is open
+
+typedef struct __attribute__((packed)) {
+    uint8_t opcode;
+    uint8_t reserved;
+    uint16_t seq;       // Copied to ack
+    uint32_t mask;      // Channel mask for SET operations
+} binctrl_request_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t opcode;
+    uint8_t status;
+    uint16_t seq;
+    uint32_t state;     // Channel state after the queued operations
+    uint32_t timestamp; // Millisecond tick when request was executed
+} binctrl_ack_t;
+
+// Execute one request and fill in the ack
+void binctrl_execute(const binctrl_request_t *req, binctrl_ack_t *ack);
@@ -1,7 +1,14 @@
 #include "board.h"
+#include "scan.h"
+#include "perf.h"
 #include <stm32f0xx_ll_utils.h>
 
 static void buttons_poll();
+static void relays_poll();
+static void relays_pwm_init();
+static void relays_set_pin_mode(relay_mask_t channels, uint32_t mode);
+static void relays_exp_init();
+static void relays_output(relay_mask_t close, relay_mask_t open);
 
 void board_init()
 {
@@ -29,8 +36,15 @@ void board_init()
     // Enable clock recovery from USB
     CRS->CR |= CRS_CR_CEN | CRS_CR_AUTOTRIMEN;
 
+    perf_init();
+
+    // Main logic runs in PendSV at the lowest priority, so that USB
+    // and SysTick can preempt it while it waits for them.
+    HAL_NVIC_SetPriority(SysTick_IRQn, 1, 0);
+    HAL_NVIC_SetPriority(PendSV_IRQn, 3, 0);
+
     // Initialize relay outputs
-    for (int i = 0; i < RELAY_COUNT; i++)
+    for (int i = 0; i < RELAY_GPIO_COUNT; i++)
     {
         uint32_t pin = (1 << (i + RELAY_PIN_SHIFT));
         HAL_GPIO_WritePin(RELAY_PORT, pin, 0);
@@ -41,6 +55,8 @@ void board_init()
             .Speed = GPIO_SPEED_LOW,
         });
     }
+    relays_pwm_init();
+    relays_exp_init();
 
     // Button inputs (active high)
     HAL_GPIO_Init(CYCLE_BTN_PORT, &(GPIO_InitTypeDef){
@@ -72,16 +88,54 @@ void board_init()
     });
 }
 
+static volatile uint32_t g_wake_at; // Tick for board_wake_at()
+static volatile bool g_wake_armed;
+
 void SysTick_Handler()
 {
+    static bool was_busy;
+    static bool was_waiting;
+
     HAL_IncTick();
     buttons_poll();
+    relays_poll();
+    scan_tick();
+
+    // Let main logic complete *OPC when background operations finish,
+    // and update status when the scan starts or stops waiting for a trigger
+    bool busy = relays_busy() || scan_running();
+    bool waiting = scan_waiting_trigger();
+    if ((was_busy && !busy) || waiting != was_waiting) board_wake();
+    was_busy = busy;
+    was_waiting = waiting;
+
+    if (g_wake_armed && (int32_t)(HAL_GetTick() - g_wake_at) >= 0)
+    {
+        g_wake_armed = false;
+        board_wake();
+    }
+}
+
+void board_wake()
+{
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+void board_wake_at(uint32_t tick)
+{
+    __disable_irq();
+    if (!g_wake_armed || (int32_t)(tick - g_wake_at) < 0)
+        g_wake_at = tick;
+    g_wake_armed = true;
+    __enable_irq();
 }
 
 void HardFault_Handler()
 {
-    // Turn off all relays
-    RELAY_PORT->BRR = RELAY_MASK << RELAY_PIN_SHIFT;
+    // Turn off all relays, including those held by PWM
+    // Expansion boards run from the same switched relay supply.
+    RELAY_PORT->BRR = RELAY_GPIO_MASK << RELAY_PIN_SHIFT;
+    relays_set_pin_mode(RELAY_GPIO_MASK, GPIO_MODE_OUTPUT_PP);
     PWR_EN_PORT->BSRR = PWR_EN_PIN;
 
     // Blink status LED rapidly
@@ -106,30 +160,632 @@ void set_relay_pwr(bool enable)
     }
 }
 
-void close_relays(uint32_t channels)
+// Relay actuation queue.
+// Commands only enqueue GPIO edges and return immediately. The steps are
+// applied in order from SysTick, each one waiting until the relays switched
+// by the previous step have settled. This keeps the break-before-make and
+// make-before-break sequencing without blocking the USB polling loop.
+// Channels that are already in the requested state are left out of the step,
+// and a step with no changes is not queued at all, so it costs no settle time.
+typedef struct {
+    relay_mask_t close; // Channels to energize
+    relay_mask_t open;  // Channels to release
+    uint32_t queued; // perf_now() when queued
+} relay_step_t;
+
+#define RELAY_QUEUE_LEN 8
+static relay_step_t g_relay_queue[RELAY_QUEUE_LEN];
+static volatile uint32_t g_relay_queue_head; // Advanced by relays_poll()
+static volatile uint32_t g_relay_queue_tail; // Advanced by relays_enqueue()
+static volatile uint32_t g_relay_busy_until; // Tick when last applied step has settled
+static volatile uint32_t g_relay_settle[RELAY_COUNT]; // Settle deadline per channel
+static volatile relay_mask_t g_relay_target; // State after all queued steps
+static volatile relay_mask_t g_relay_applied; // State currently driven to relay outputs
+static volatile uint32_t g_relay_queue_stalls; // Enqueues that had to wait for space
+static volatile uint32_t g_relay_cycles[RELAY_COUNT]; // Operations since first use
+
+// Operate and release times per channel, configurable at runtime
+static uint16_t g_relay_delay[RELAY_COUNT][2] = {
+    [0 ... RELAY_COUNT - 1] = {
+        [RELAY_OPERATE] = RELAY_OPERATE_DELAY_MS,
+        [RELAY_RELEASE] = RELAY_RELEASE_DELAY_MS
+    }
+};
+
+static volatile relay_mask_t g_relay_held; // Channels driven by PWM hold duty
+static uint32_t g_relay_hold_duty = RELAY_HOLD_DUTY_DEFAULT;
+static uint32_t g_relay_budget_ua = RELAY_CURRENT_BUDGET_DEFAULT_UA;
+
+// All channels share the hold duty, so a pin only needs to be switched
+// between GPIO output (full drive or off) and timer output (hold).
+static void relays_pwm_init()
+{
+    static const uint8_t af[RELAY_GPIO_COUNT] = RELAY_PIN_AF;
+    for (int i = 0; i < RELAY_GPIO_COUNT; i++)
+    {
+        uint32_t pin = i + RELAY_PIN_SHIFT;
+        uint32_t shift = (pin & 7) * 4;
+        RELAY_PORT->AFR[pin >> 3] = (RELAY_PORT->AFR[pin >> 3] & ~(0xF << shift)) | (af[i] << shift);
+    }
+
+    __HAL_RCC_TIM2_CLK_ENABLE();
+    __HAL_RCC_TIM3_CLK_ENABLE();
+    __HAL_RCC_TIM14_CLK_ENABLE();
+
+    // PWM mode 1 with preload on all used channels
+    const uint32_t pwm12 = TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1PE |
+                           TIM_CCMR1_OC2M_2 | TIM_CCMR1_OC2M_1 | TIM_CCMR1_OC2PE;
+    const uint32_t pwm34 = TIM_CCMR2_OC3M_2 | TIM_CCMR2_OC3M_1 | TIM_CCMR2_OC3PE |
+                           TIM_CCMR2_OC4M_2 | TIM_CCMR2_OC4M_1 | TIM_CCMR2_OC4PE;
+
+    TIM2->CCMR1 = pwm12;
+    TIM2->CCMR2 = pwm34;
+    TIM2->CCER = TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E;
+    TIM3->CCMR1 = pwm12;
+    TIM3->CCER = TIM_CCER_CC1E | TIM_CCER_CC2E;
+    TIM14->CCMR1 = TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1PE;
+    TIM14->CCER = TIM_CCER_CC1E;
+
+    TIM_TypeDef *const timers[] = {TIM2, TIM3, TIM14};
+    for (int i = 0; i < 3; i++)
+    {
+        timers[i]->PSC = 0;
+        timers[i]->ARR = RELAY_PWM_PERIOD - 1;
+    }
+
+    relays_set_hold_duty(RELAY_HOLD_DUTY_DEFAULT);
+
+    for (int i = 0; i < 3; i++)
+    {
+        timers[i]->EGR = TIM_EGR_UG;
+        timers[i]->CR1 = TIM_CR1_ARPE | TIM_CR1_CEN;
+    }
+}
+
+// Switch relay pins between GPIO output and timer output.
+// Must be called with interrupts disabled or from SysTick.
+static void relays_set_pin_mode(relay_mask_t channels, uint32_t mode)
 {
-    RELAY_PORT->BSRR = (channels & RELAY_MASK) << RELAY_PIN_SHIFT;
-    HAL_Delay(RELAY_OPERATE_DELAY_MS);
+    uint32_t moder = RELAY_PORT->MODER;
+    for (int i = 0; i < RELAY_GPIO_COUNT; i++)
+    {
+        if (channels & RELAY_BIT(i))
+        {
+            uint32_t shift = (i + RELAY_PIN_SHIFT) * 2;
+            moder = (moder & ~(3 << shift)) | (mode << shift);
+        }
+    }
+    RELAY_PORT->MODER = moder;
 }
 
-void open_relays(uint32_t channels)
+#if RELAY_EXP_BOARDS > 0
+#define RELAY_EXP_BYTES (RELAY_EXP_BOARDS * RELAY_EXP_CHANNELS / 8)
+
+// Shift out expansion channels, last board of the chain first
+static void relays_exp_shift(relay_mask_t state)
+{
+    for (int i = RELAY_EXP_BYTES - 1; i >= 0; i--)
+    {
+        while (!(RELAY_EXP_SPI->SR & SPI_SR_TXE));
+        *(volatile uint8_t *)&RELAY_EXP_SPI->DR = state >> (RELAY_GPIO_COUNT + i * 8);
+    }
+
+    while (RELAY_EXP_SPI->SR & SPI_SR_BSY);
+}
+
+// Shift register chain on SPI1, mode 0, MSB first.
+// 6 MHz from fPCLK / 4 is within 74HC595 limits at 3.3 V.
+static void relays_exp_init()
+{
+    __HAL_RCC_SPI1_CLK_ENABLE();
+
+    HAL_GPIO_Init(RELAY_EXP_SCK_PORT, &(GPIO_InitTypeDef){
+        .Pin = RELAY_EXP_SCK_PIN,
+        .Mode = GPIO_MODE_AF_PP,
+        .Pull = GPIO_NOPULL,
+        .Speed = GPIO_SPEED_FREQ_HIGH,
+        .Alternate = GPIO_AF0_SPI1,
+    });
+    HAL_GPIO_Init(RELAY_EXP_MOSI_PORT, &(GPIO_InitTypeDef){
+        .Pin = RELAY_EXP_MOSI_PIN,
+        .Mode = GPIO_MODE_AF_PP,
+        .Pull = GPIO_NOPULL,
+        .Speed = GPIO_SPEED_FREQ_HIGH,
+        .Alternate = GPIO_AF0_SPI1,
+    });
+    HAL_GPIO_WritePin(RELAY_PORT, RELAY_EXP_LATCH_PIN, 0);
+    HAL_GPIO_Init(RELAY_PORT, &(GPIO_InitTypeDef){
+        .Pin = RELAY_EXP_LATCH_PIN,
+        .Mode = GPIO_MODE_OUTPUT_PP,
+        .Pull = GPIO_NOPULL,
+        .Speed = GPIO_SPEED_FREQ_HIGH,
+    });
+
+    RELAY_EXP_SPI->CR2 = SPI_CR2_FRXTH | SPI_CR2_DS_2 | SPI_CR2_DS_1 | SPI_CR2_DS_0; // 8 bits
+    RELAY_EXP_SPI->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BR_0 | SPI_CR1_SPE;
+
+    // Register outputs are undefined until first latched. Relay supply is
+    // still off here, see set_relay_pwr().
+    relays_exp_shift(0);
+    RELAY_PORT->BSRR = RELAY_EXP_LATCH_PIN;
+    RELAY_PORT->BRR = RELAY_EXP_LATCH_PIN;
+}
+#else
+static void relays_exp_init()
 {
-    RELAY_PORT->BRR = (channels & RELAY_MASK) << RELAY_PIN_SHIFT;
-    HAL_Delay(RELAY_RELEASE_DELAY_MS);
 }
+#endif
 
-uint32_t relays_get_state()
+// Drive outputs of all banks for channels to close and open. Expansion
+// registers are loaded first, then a single BSRR write sets the GPIO bank
+// and the latch edge, so that all channels switch together.
+// Must be called with interrupts disabled or from SysTick.
+static void relays_output(relay_mask_t close, relay_mask_t open)
 {
-    return (RELAY_PORT->ODR >> RELAY_PIN_SHIFT) & RELAY_MASK;
+    relay_mask_t state = (g_relay_applied | close) & ~open;
+    uint32_t bsrr = ((uint32_t)(close & RELAY_GPIO_MASK) << RELAY_PIN_SHIFT) |
+                    ((uint32_t)(open & RELAY_GPIO_MASK) << (RELAY_PIN_SHIFT + 16));
+
+#if RELAY_EXP_BOARDS > 0
+    if ((close | open) & ~(relay_mask_t)RELAY_GPIO_MASK)
+    {
+        relays_exp_shift(state);
+        bsrr |= RELAY_EXP_LATCH_PIN;
+    }
+#endif
+
+    RELAY_PORT->BSRR = bsrr;
+    g_relay_applied = state;
+
+#if RELAY_EXP_BOARDS > 0
+    RELAY_PORT->BRR = RELAY_EXP_LATCH_PIN;
+#endif
+}
+
+void relays_set_hold_duty(uint32_t percent)
+{
+    uint32_t ccr = RELAY_PWM_PERIOD * percent / 100;
+
+    __disable_irq();
+    g_relay_hold_duty = percent;
+    TIM2->CCR1 = TIM2->CCR2 = TIM2->CCR3 = TIM2->CCR4 = ccr;
+    TIM3->CCR1 = TIM3->CCR2 = ccr;
+    TIM14->CCR1 = ccr;
+
+    if (percent >= 100)
+    {
+        // Economizer disabled, back to full drive
+        relays_set_pin_mode(g_relay_held, GPIO_MODE_OUTPUT_PP);
+        g_relay_held = 0;
+    }
+    __enable_irq();
+}
+
+uint32_t relays_get_hold_duty()
+{
+    return g_relay_hold_duty;
+}
+
+// Current of a closed coil: inrush until its operate time has passed, then hold
+static uint32_t relay_coil_current(int channel, uint32_t now)
+{
+    if (g_relay_held & RELAY_BIT(channel))
+        return RELAY_COIL_CURRENT_UA * g_relay_hold_duty / 100;
+    if ((int32_t)(now - g_relay_settle[channel]) < 0)
+        return RELAY_COIL_INRUSH_UA;
+    return RELAY_COIL_CURRENT_UA;
+}
+
+uint32_t relays_get_coil_current(int channel)
+{
+    if (!(g_relay_applied & RELAY_BIT(channel)))
+        return 0;
+    return relay_coil_current(channel, HAL_GetTick());
+}
+
+void relays_set_current_budget(uint32_t budget_ua)
+{
+    g_relay_budget_ua = budget_ua;
+}
+
+uint32_t relays_get_current_budget()
+{
+    return g_relay_budget_ua;
+}
+
+// Channels of close that are energised together on top of load, in channel order.
+// All coils are alike, so filling each slot greedily gives the fewest slots.
+// At least one channel is returned, so a budget that is already exhausted by
+// held relays slows the transition down instead of stalling the queue.
+static relay_mask_t relays_slot(relay_mask_t close, uint32_t load)
+{
+    relay_mask_t slot = 0;
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if (!(close & RELAY_BIT(i)))
+            continue;
+
+        if (slot && load + RELAY_COIL_INRUSH_UA > g_relay_budget_ua)
+            break;
+
+        slot |= RELAY_BIT(i);
+        load += RELAY_COIL_INRUSH_UA;
+    }
+    return slot;
+}
+
+// Drop closed relays whose operate time has passed to hold duty
+static void relays_economize(uint32_t now)
+{
+    if (g_relay_hold_duty >= 100)
+        return;
+
+    // Only the GPIO bank has PWM outputs
+    relay_mask_t hold = 0;
+    for (int i = 0; i < RELAY_GPIO_COUNT; i++)
+    {
+        if ((g_relay_applied & ~g_relay_held & RELAY_BIT(i)) && (int32_t)(now - g_relay_settle[i]) >= 0)
+            hold |= RELAY_BIT(i);
+    }
+
+    if (hold)
+    {
+        relays_set_pin_mode(hold, GPIO_MODE_AF_PP);
+        g_relay_held |= hold;
+    }
+}
+
+// Time from applying a step until all its channels have settled.
+// One extra tick gives HAL_Delay() semantics: wait at least the full delay.
+static uint32_t relay_step_time(relay_mask_t close, relay_mask_t open)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        uint32_t delay = 0;
+        if (close & RELAY_BIT(i)) delay = g_relay_delay[i][RELAY_OPERATE];
+        if (open & RELAY_BIT(i)) delay = g_relay_delay[i][RELAY_RELEASE];
+        if ((close | open) & RELAY_BIT(i) && delay + 1 > result) result = delay + 1;
+    }
+    return result;
+}
+
+// Time to close channels in budget slots, starting with closed channels at hold current
+static uint32_t relay_close_time(relay_mask_t closed, relay_mask_t close)
+{
+    uint32_t hold_ua = RELAY_COIL_CURRENT_UA * g_relay_hold_duty / 100;
+    uint32_t result = 0;
+
+    while (close)
+    {
+        uint32_t load = RELAY_POPCOUNT(closed & RELAY_GPIO_MASK) * hold_ua +
+                        RELAY_POPCOUNT(closed & ~(relay_mask_t)RELAY_GPIO_MASK) * RELAY_COIL_CURRENT_UA;
+        relay_mask_t slot = relays_slot(close, load);
+        result += relay_step_time(slot, 0);
+        closed |= slot;
+        close &= ~slot;
+    }
+    return result;
+}
+
+// Apply queued steps whose previous step has settled.
+// A close step that exceeds the current budget is applied in several slots,
+// each waiting for the previous one to reach hold current. The step stays
+// at the head of the queue until done, so BBM/MBB ordering is kept.
+// Called from SysTick and, with interrupts disabled, from relays_enqueue().
+static void relays_poll()
+{
+    uint32_t now = HAL_GetTick();
+
+    // Relays of the previous slot drop to hold current first
+    relays_economize(now);
+
+    while (g_relay_queue_head != g_relay_queue_tail &&
+           (int32_t)(now - g_relay_busy_until) >= 0)
+    {
+        relay_step_t *step = &g_relay_queue[g_relay_queue_head % RELAY_QUEUE_LEN];
+        relay_mask_t close = 0;
+
+        if (step->close)
+        {
+            uint32_t load = 0;
+            for (int i = 0; i < RELAY_COUNT; i++)
+            {
+                if (g_relay_applied & RELAY_BIT(i)) load += relay_coil_current(i, now);
+            }
+
+            close = relays_slot(step->close, load);
+            step->close &= ~close;
+        }
+
+        relays_output(close, step->open);
+
+        if (step->open)
+        {
+            // Output is low before a held pin leaves timer control
+            relays_set_pin_mode(step->open & g_relay_held, GPIO_MODE_OUTPUT_PP);
+            g_relay_held &= ~step->open;
+        }
+
+        for (int i = 0; i < RELAY_COUNT; i++)
+        {
+            if (close & RELAY_BIT(i))
+            {
+                g_relay_settle[i] = now + g_relay_delay[i][RELAY_OPERATE] + 1;
+                g_relay_cycles[i]++;
+            }
+            if (step->open & RELAY_BIT(i)) g_relay_settle[i] = now + g_relay_delay[i][RELAY_RELEASE] + 1;
+        }
+
+        g_relay_busy_until = now + relay_step_time(close, step->open);
+        step->open = 0;
+
+        if (!step->close)
+        {
+            perf_record(PERF_ACTUATE, step->queued);
+            g_relay_queue_head++;
+        }
+    }
+}
+
+// May be called from main context or from SysTick.
+// From SysTick, the queue must have space (e.g. !relays_busy()).
+static void relays_enqueue(relay_mask_t close, relay_mask_t open)
+{
+    uint32_t start = perf_now();
+    bool stalled = false;
+
+    while (1)
+    {
+        __disable_irq();
+
+        // Only channels that change state need to be switched
+        close &= ~g_relay_target;
+        open &= g_relay_target;
+        if (!close && !open)
+        {
+            __enable_irq();
+            return;
+        }
+
+        uint32_t tail = g_relay_queue_tail;
+        if (tail - g_relay_queue_head < RELAY_QUEUE_LEN)
+        {
+            g_relay_queue[tail % RELAY_QUEUE_LEN] = (relay_step_t){.close = close, .open = open, .queued = start};
+            g_relay_queue_tail = tail + 1;
+            g_relay_target = (g_relay_target | close) & ~open;
+
+            // Start immediately if relays are idle, instead of waiting for next tick
+            relays_poll();
+            __enable_irq();
+            perf_record(PERF_ENQUEUE, start);
+            return;
+        }
+        __enable_irq();
+
+        // Queue full, sleep until SysTick frees up space
+        if (!stalled)
+        {
+            stalled = true;
+            g_relay_queue_stalls++;
+        }
+        __WFI();
+    }
+}
+
+void relays_set_delay(relay_mask_t channels, relay_delay_t type, uint32_t delay_ms)
+{
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if (channels & RELAY_BIT(i)) g_relay_delay[i][type] = delay_ms;
+    }
+}
+
+uint32_t relays_get_delay(int channel, relay_delay_t type)
+{
+    return g_relay_delay[channel][type];
+}
+
+uint32_t relays_predict(relay_mask_t target)
+{
+    __disable_irq();
+    uint32_t now = HAL_GetTick();
+    uint32_t result = 0;
+    if ((int32_t)(g_relay_busy_until - now) > 0)
+    {
+        result = g_relay_busy_until - now;
+    }
+
+    // Steps are either close or open, see close_relays() and open_relays()
+    relay_mask_t closed = g_relay_applied;
+    for (uint32_t i = g_relay_queue_head; i != g_relay_queue_tail; i++)
+    {
+        relay_step_t *step = &g_relay_queue[i % RELAY_QUEUE_LEN];
+        result += relay_close_time(closed, step->close) + relay_step_time(0, step->open);
+        closed = (closed | step->close) & ~step->open;
+    }
+
+    relay_mask_t state = g_relay_target;
+    __enable_irq();
+
+    // Transition is done as separate open and close steps, in either order.
+    // Closing first is slower when relays being released still use the budget.
+    uint32_t open_time = relay_step_time(0, state & ~target);
+    uint32_t bbm = relay_close_time(state & target, target & ~state);
+    uint32_t mbb = relay_close_time(state, target & ~state);
+    return result + open_time + (mbb > bbm ? mbb : bbm);
+}
+
+uint32_t relays_worst_case()
+{
+    // Release everything, then close the channels not kept closed. Kept
+    // channels use part of the budget, so every number of them is tried.
+    uint32_t result = 0;
+    for (int kept = 0; kept < RELAY_COUNT; kept++)
+    {
+        relay_mask_t mask = RELAY_BIT(kept) - 1;
+        uint32_t time = relay_close_time(mask, RELAY_MASK & ~mask);
+        if (time > result) result = time;
+    }
+    return result + relay_step_time(0, RELAY_MASK);
+}
+
+void close_relays(relay_mask_t channels)
+{
+    relays_enqueue(channels & RELAY_MASK, 0);
+}
+
+void open_relays(relay_mask_t channels)
+{
+    relays_enqueue(0, channels & RELAY_MASK);
+}
+
+void relays_set_state(relay_mask_t target, bool make_before_break)
+{
+    relay_mask_t state = relays_get_state();
+
+    if (!make_before_break)
+    {
+        // Break before make
+        open_relays(state & ~target);
+        close_relays(target);
+    }
+    else
+    {
+        // Make before break. In exclusive mode, a group that switches to
+        // another channel is still broken first, so its channels never short.
+        relay_mask_t opening = state & ~target;
+        relay_mask_t first = 0;
+        if (mux_get_exclusive())
+        {
+            for (int i = 0; i < MUX_GROUP_COUNT; i++)
+            {
+                if (target & ~state & mux_group_mask(i))
+                    first |= opening & mux_group_mask(i);
+            }
+        }
+
+        open_relays(first);
+        close_relays(target);
+        open_relays(opening & ~first);
+    }
+}
+
+static const relay_mask_t g_mux_groups[MUX_GROUP_COUNT] = MUX_GROUP_MASKS;
+static bool g_mux_exclusive;
+
+// True if at most one channel of each group is set
+static bool mux_one_per_group(relay_mask_t channels)
+{
+    for (int i = 0; i < MUX_GROUP_COUNT; i++)
+    {
+        relay_mask_t ch = channels & g_mux_groups[i];
+        if (ch & (ch - 1)) return false;
+    }
+    return true;
+}
+
+// Fails if enabling while more than one channel of a group is closed
+bool mux_set_exclusive(bool enable)
+{
+    if (enable && !mux_one_per_group(relays_get_state()))
+        return false;
+
+    g_mux_exclusive = enable;
+    return true;
+}
+
+bool mux_get_exclusive()
+{
+    return g_mux_exclusive;
+}
+
+relay_mask_t mux_group_mask(int group)
+{
+    return g_mux_groups[group];
+}
+
+bool mux_state_valid(relay_mask_t state)
+{
+    return !g_mux_exclusive || mux_one_per_group(state);
+}
+
+relay_mask_t mux_select_state(relay_mask_t state, relay_mask_t channels, uint32_t empty_groups)
+{
+    for (int i = 0; i < MUX_GROUP_COUNT; i++)
+    {
+        if ((channels & g_mux_groups[i]) || (empty_groups & (1 << i)))
+        {
+            state = (state & ~g_mux_groups[i]) | (channels & g_mux_groups[i]);
+        }
+    }
+    return state;
+}
+
+relay_mask_t relays_get_state()
+{
+    return g_relay_target;
+}
+
+uint32_t relays_queue_stalls()
+{
+    return g_relay_queue_stalls;
+}
+
+uint32_t relays_card_channel(uint32_t card, uint32_t channel)
+{
+    if (card == 1 && channel >= 1 && channel <= RELAY_GPIO_COUNT)
+        return channel;
+    if (card >= 2 && card <= RELAY_CARD_COUNT && channel >= 1 && channel <= RELAY_EXP_CHANNELS)
+        return RELAY_GPIO_COUNT + (card - 2) * RELAY_EXP_CHANNELS + channel;
+    return 0;
+}
+
+uint32_t relays_get_cycles(int channel)
+{
+    return g_relay_cycles[channel];
+}
+
+void relays_set_cycles(int channel, uint32_t cycles)
+{
+    g_relay_cycles[channel] = cycles;
+}
+
+relay_mask_t relays_settling()
+{
+    uint32_t now = HAL_GetTick();
+    relay_mask_t result = 0;
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if ((int32_t)(now - g_relay_settle[i]) < 0) result |= RELAY_BIT(i);
+    }
+    return result;
+}
+
+bool relays_busy()
+{
+    return g_relay_queue_head != g_relay_queue_tail ||
+           (int32_t)(HAL_GetTick() - g_relay_busy_until) < 0;
+}
+
+void relays_wait()
+{
+    while (relays_busy())
+    {
+        // Sleep until SysTick finishes the queue
+        __WFI();
+    }
 }
 
 static volatile uint32_t g_prev_button_press;
 static volatile uint32_t g_buttons_pressed;
 
+static volatile bool g_trigger_input;
+
 static void buttons_poll()
 {
     uint32_t buttons = 0;
-    if (CYCLE_BTN_PORT->IDR & CYCLE_BTN_PIN) buttons |= BTN_CYCLE;
+    if (!g_trigger_input && (CYCLE_BTN_PORT->IDR & CYCLE_BTN_PIN)) buttons |= BTN_CYCLE;
     if (CLEAR_BTN_PORT->IDR & CLEAR_BTN_PIN) buttons |= BTN_CLEAR;
 
     if (buttons)
@@ -137,6 +793,12 @@ static void buttons_poll()
         g_prev_button_press = HAL_GetTick();
         g_buttons_pressed |= buttons;
     }
+    else if (g_buttons_pressed != 0 &&
+             (int32_t)(HAL_GetTick() - g_prev_button_press) > BTN_DEBOUNCE_TIME_MS)
+    {
+        // Released long enough, read_buttons() will report it
+        board_wake();
+    }
 }
 
 uint32_t read_buttons()
@@ -152,6 +814,42 @@ uint32_t read_buttons()
     return 0;
 }
 
+void trigger_input_enable(bool enable)
+{
+    const uint32_t line = 1 << TRIGGER_EXTI_LINE;
+
+    if (enable)
+    {
+        // Same priority as SysTick, so that the handler can step the scan
+        // without being preempted by or preempting relay queue processing.
+        __HAL_RCC_SYSCFG_CLK_ENABLE();
+        SYSCFG->EXTICR[TRIGGER_EXTI_LINE / 4] =
+            (SYSCFG->EXTICR[TRIGGER_EXTI_LINE / 4] & ~(0xF << (TRIGGER_EXTI_LINE % 4 * 4))) |
+            (TRIGGER_EXTI_PORT << (TRIGGER_EXTI_LINE % 4 * 4));
+        EXTI->RTSR |= line;
+        EXTI->PR = line;
+        EXTI->IMR |= line;
+        HAL_NVIC_SetPriority(TRIGGER_IRQn, 1, 0);
+        HAL_NVIC_EnableIRQ(TRIGGER_IRQn);
+    }
+    else
+    {
+        EXTI->IMR &= ~line;
+        HAL_NVIC_DisableIRQ(TRIGGER_IRQn);
+    }
+
+    g_trigger_input = enable;
+}
+
+void EXTI0_1_IRQHandler()
+{
+    EXTI->PR = 1 << TRIGGER_EXTI_LINE;
+
+    // Switch right away instead of on the next tick
+    scan_trigger();
+    scan_tick();
+}
+
 uint8_t g_logbuf[256];
 uint32_t g_logidx;
 
@@ -4,6 +4,7 @@
 
 #include <stm32f042x6.h>
 #include <stm32f0xx_hal.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 #define CYCLE_BTN_PORT  GPIOF
@@ -14,6 +15,11 @@
 
 #define BTN_DEBOUNCE_TIME_MS 100
 
+// External trigger input shares the CYCLE button pin (PF0 = EXTI line 0)
+#define TRIGGER_EXTI_LINE   0
+#define TRIGGER_EXTI_PORT   5 // SYSCFG_EXTICR port index of GPIOF
+#define TRIGGER_IRQn        EXTI0_1_IRQn
+
 #define STATUS_LED_PORT GPIOF
 #define STATUS_LED_PIN  GPIO_PIN_1
 #define STATUS_LED_ON() STATUS_LED_PORT->BRR = STATUS_LED_PIN
@@ -22,19 +28,169 @@
 #define PWR_EN_PORT     GPIOB
 #define PWR_EN_PIN      GPIO_PIN_1
 
+// Board description. Channels 1..RELAY_GPIO_COUNT are GPIO pins of the
+// main board, followed by RELAY_EXP_CHANNELS per expansion board. The
+// expansion boards are chained 74HC595 shift registers on SPI1, whose
+// latch shares RELAY_PORT with the GPIO bank, so one BSRR write updates
+// all banks at once. Define RELAY_EXP_BOARDS to build for expansions.
 #define RELAY_PORT      GPIOA
 #define RELAY_PIN_SHIFT 0
-#define RELAY_COUNT     8
-#define RELAY_MASK      0xFF
-#define RELAY_OPERATE_DELAY_MS  10
+#define RELAY_GPIO_COUNT 8
+#define RELAY_GPIO_MASK 0xFF
+
+#ifndef RELAY_EXP_BOARDS
+#define RELAY_EXP_BOARDS    0
+#endif
+#ifndef RELAY_EXP_CHANNELS
+#define RELAY_EXP_CHANNELS  16 // Two 74HC595 per board
+#endif
+#if RELAY_EXP_CHANNELS % 8 != 0
+#error "Expansion boards must have whole shift registers"
+#endif
+#define RELAY_EXP_SPI       SPI1
+#define RELAY_EXP_SCK_PORT  GPIOB
+#define RELAY_EXP_SCK_PIN   GPIO_PIN_3
+#define RELAY_EXP_MOSI_PORT GPIOB
+#define RELAY_EXP_MOSI_PIN  GPIO_PIN_5
+#define RELAY_EXP_LATCH_PIN GPIO_PIN_15 // On RELAY_PORT, rising edge latches
+
+#define RELAY_COUNT     (RELAY_GPIO_COUNT + RELAY_EXP_BOARDS * RELAY_EXP_CHANNELS)
+
+// Channel masks are as wide as needed for RELAY_COUNT, up to 64 channels
+#if RELAY_COUNT > 64
+#error "Channel masks are limited to 64 channels"
+#elif RELAY_COUNT > 32
+typedef uint64_t relay_mask_t;
+#define RELAY_POPCOUNT(mask) __builtin_popcountll(mask)
+#else
+typedef uint32_t relay_mask_t;
+#define RELAY_POPCOUNT(mask) __builtin_popcount(mask)
+#endif
+
+#define RELAY_BIT(channel) ((relay_mask_t)1 << (channel))
+#define RELAY_MASK      ((relay_mask_t)-1 >> (sizeof(relay_mask_t) * 8 - RELAY_COUNT))
+
+// SCPI cards: card 1 is the main board, cards 2.. are expansion boards
+#define RELAY_CARD_COUNT (1 + RELAY_EXP_BOARDS)
+
+#define RELAY_OPERATE_DELAY_MS  10 // Default, see relays_set_delay()
 #define RELAY_RELEASE_DELAY_MS  10
+#define RELAY_MAX_DELAY_MS      1000
+
+// Coil economizer: after the operate time, closed relays of the GPIO bank
+// are held with PWM. Expansion board relays stay at full coil current.
+// Relay pins are timer outputs: PA0-PA3 TIM2_CH1-4, PA4 TIM14_CH1,
+// PA5 TIM2_CH1 (shared with PA0), PA6-PA7 TIM3_CH1-2.
+#define RELAY_PIN_AF            {GPIO_AF2_TIM2, GPIO_AF2_TIM2, GPIO_AF2_TIM2, GPIO_AF2_TIM2, \
+                                 GPIO_AF4_TIM14, GPIO_AF2_TIM2, GPIO_AF1_TIM3, GPIO_AF1_TIM3}
+#define RELAY_PWM_PERIOD        2400  // 20 kHz from 48 MHz timer clock
+#define RELAY_HOLD_DUTY_DEFAULT 50    // Percent of full coil voltage
+#define RELAY_HOLD_DUTY_MIN     35    // Margin above TQ2SA must-release voltage
+#define RELAY_COIL_CURRENT_UA   28000 // TQ2SA-5V: 140 mW at 5 V
+#define RELAY_COIL_INRUSH_UA    28000 // Until operate time, limited by coil resistance
+
+// Coils energised at the same time must fit in the current budget,
+// see relays_set_current_budget()
+#define RELAY_CURRENT_BUDGET_DEFAULT_UA 150000
+#define RELAY_CURRENT_BUDGET_MAX_UA     500000
+
+// Each half of the main board is a 1-of-4 mux
+#define MUX_GROUP_COUNT 2
+#define MUX_GROUP_MASKS {0x0F, 0xF0}
+
+// Last 2 KB of flash hold the preset log, see presets.c.
+// The image size limit in boards/relaymux.json keeps code out of it, and
+// boards/preset_guard.ld fails the link if the image reaches it.
+#define PRESET_FLASH_ADDR   (FLASH_BASE + 30 * 1024)
+#define PRESET_FLASH_PAGES  2
 
 void board_init();
 
+// Request main logic to run, see PendSV_Handler() in main.c.
+// Called from interrupts when there is new work.
+void board_wake();
+
+// Request main logic to run once the tick count reaches tick.
+// Of two requests that have not run yet, the earlier one is kept.
+// The tick must not have passed, or the request runs on every tick.
+void board_wake_at(uint32_t tick);
+
 void set_relay_pwr(bool enable);
-void close_relays(uint32_t channels);
-void open_relays(uint32_t channels);
-uint32_t relays_get_state();
+
+// Relay operations are queued and return immediately.
+// Queued steps are executed in order, each waiting for the previous one to settle.
+void close_relays(relay_mask_t channels);
+void open_relays(relay_mask_t channels);
+
+// Queue transition to target state, opening and closing channels in the requested order.
+// In exclusive mux mode, make-before-break applies only between different groups.
+void relays_set_state(relay_mask_t target, bool make_before_break);
+
+// Returns the state that relays will have after queued operations complete
+relay_mask_t relays_get_state();
+
+typedef enum {
+    RELAY_OPERATE = 0,
+    RELAY_RELEASE = 1
+} relay_delay_t;
+
+// Set operate or release time for channels
+void relays_set_delay(relay_mask_t channels, relay_delay_t type, uint32_t delay_ms);
+uint32_t relays_get_delay(int channel, relay_delay_t type);
+
+// Hold duty in percent for closed relays, 100 disables the economizer
+void relays_set_hold_duty(uint32_t percent);
+uint32_t relays_get_hold_duty();
+
+// Channel number (1-based) of a channel on a card, 0 if there is no such channel
+uint32_t relays_card_channel(uint32_t card, uint32_t channel);
+
+// Returns estimated coil current of a channel in microamps
+uint32_t relays_get_coil_current(int channel);
+
+// Total coil current allowed while relays are operating, in microamps.
+// Large transitions are split into time slots that stay within the budget.
+void relays_set_current_budget(uint32_t budget_ua);
+uint32_t relays_get_current_budget();
+
+// Returns time in milliseconds until relays would have settled,
+// if transition to target was requested now.
+uint32_t relays_predict(relay_mask_t target);
+
+// Returns worst-case time in milliseconds for a transition from idle relays
+uint32_t relays_worst_case();
+
+// In exclusive mode, at most one channel of each mux group may be closed.
+bool mux_set_exclusive(bool enable);
+bool mux_get_exclusive();
+
+// Returns mask of channels belonging to mux group (0-based)
+relay_mask_t mux_group_mask(int group);
+
+// Returns false if state would violate mux exclusivity
+bool mux_state_valid(relay_mask_t state);
+
+// Returns state with each mux group that contains one of the channels
+// switched to that channel, or to no channel if empty_groups includes it.
+// Channels must have at most one channel in any group.
+relay_mask_t mux_select_state(relay_mask_t state, relay_mask_t channels, uint32_t empty_groups);
+
+// Returns mask of channels that have switched but not yet settled
+relay_mask_t relays_settling();
+
+// Returns true if relay operations are queued or still settling
+bool relays_busy();
+
+// Returns number of relay operations that had to wait for queue space
+uint32_t relays_queue_stalls();
+
+// Number of times a channel has operated, restored from flash at startup.
+// Releases are not counted separately, each follows an operation.
+uint32_t relays_get_cycles(int channel);
+void relays_set_cycles(int channel, uint32_t cycles);
+
+// Block until all queued relay operations have settled
+void relays_wait();
 
 #define BTN_CYCLE   0x01
 #define BTN_CLEAR   0x02
@@ -42,6 +198,10 @@ uint32_t relays_get_state();
 // Returns button presses exactly once per press-and-release
 uint32_t read_buttons();
 
+// Use CYCLE input as external trigger instead of a button. Rising edges
+// advance the scan from the EXTI interrupt, see scan_trigger().
+void trigger_input_enable(bool enable);
+
 // Simple logging to memory ringbuffer
 void board_log(const char *data);
 
@@ -0,0 +1,182 @@
+#include "chanlist.h"
+#include <stdbool.h>
+#include <string.h>
+
+static void skip_spaces(chanlist_iter_t *iter)
+{
+    while (iter->pos < iter->end && (*iter->pos == ' ' || *iter->pos == '\t'))
+        iter->pos++;
+}
+
+static bool parse_number(chanlist_iter_t *iter, uint32_t *value)
+{
+    skip_spaces(iter);
+
+    const char *start = iter->pos;
+    uint32_t result = 0;
+    while (iter->pos < iter->end && *iter->pos >= '0' && *iter->pos <= '9')
+    {
+        if (result > 9999) return false; // Far beyond any channel number
+        result = result * 10 + (*iter->pos++ - '0');
+    }
+
+    *value = result;
+    return iter->pos != start;
+}
+
+// Channel as plain number or card!channel
+static chanlist_result_t parse_channel(chanlist_iter_t *iter, uint32_t *channel)
+{
+    uint32_t card;
+
+    if (!parse_number(iter, channel))
+        return CHANLIST_SYNTAX;
+
+    skip_spaces(iter);
+    if (iter->pos < iter->end && *iter->pos == '!')
+    {
+        iter->pos++;
+        card = *channel;
+        if (!parse_number(iter, channel))
+            return CHANLIST_SYNTAX;
+
+        *channel = relays_card_channel(card, *channel);
+        if (*channel == 0)
+            return CHANLIST_RANGE;
+    }
+
+    return CHANLIST_OK;
+}
+
+chanlist_result_t chanlist_begin(chanlist_iter_t *iter, const char *text, size_t len)
+{
+    iter->pos = text;
+    iter->end = text + len;
+
+    skip_spaces(iter);
+    if (iter->end - iter->pos < 3 || iter->pos[0] != '(' || iter->pos[1] != '@')
+        return CHANLIST_SYNTAX;
+    iter->pos += 2;
+
+    // Closing parenthesis is checked once here, so entries can stop at it
+    while (iter->end > iter->pos && (iter->end[-1] == ' ' || iter->end[-1] == '\t'))
+        iter->end--;
+    if (iter->end[-1] != ')')
+        return CHANLIST_SYNTAX;
+    iter->end--;
+
+    skip_spaces(iter);
+    return CHANLIST_OK;
+}
+
+chanlist_result_t chanlist_next(chanlist_iter_t *iter, uint32_t *first, uint32_t *last)
+{
+    skip_spaces(iter);
+    if (iter->pos >= iter->end)
+        return CHANLIST_END;
+
+    chanlist_result_t res;
+    if ((res = parse_channel(iter, first)) != CHANLIST_OK)
+        return res;
+
+    skip_spaces(iter);
+    if (iter->pos < iter->end && *iter->pos == ':')
+    {
+        iter->pos++;
+        if ((res = parse_channel(iter, last)) != CHANLIST_OK)
+            return res;
+        skip_spaces(iter);
+    }
+    else
+    {
+        *last = *first;
+    }
+
+    if (iter->pos < iter->end)
+    {
+        if (*iter->pos != ',')
+            return CHANLIST_SYNTAX;
+        iter->pos++;
+
+        // Trailing comma is not allowed
+        skip_spaces(iter);
+        if (iter->pos >= iter->end)
+            return CHANLIST_SYNTAX;
+    }
+
+    return CHANLIST_OK;
+}
+
+// Mask of channels 1..n
+static relay_mask_t mask_upto(uint32_t n)
+{
+    return (n >= sizeof(relay_mask_t) * 8) ? (relay_mask_t)-1 : (RELAY_BIT(n) - 1);
+}
+
+static chanlist_result_t compile(const char *text, size_t len, uint32_t max_channel, relay_mask_t *mask)
+{
+    chanlist_iter_t iter;
+    chanlist_result_t res;
+    uint32_t first, last;
+
+    *mask = 0;
+    if ((res = chanlist_begin(&iter, text, len)) != CHANLIST_OK)
+        return res;
+
+    while ((res = chanlist_next(&iter, &first, &last)) == CHANLIST_OK)
+    {
+        if (first > last)
+        {
+            uint32_t tmp = first;
+            first = last;
+            last = tmp;
+        }
+
+        if (first < 1 || last > max_channel)
+            return CHANLIST_RANGE;
+
+        *mask |= mask_upto(last) & ~mask_upto(first - 1);
+    }
+
+    return (res == CHANLIST_END) ? CHANLIST_OK : res;
+}
+
+// Scripts tend to repeat the same few lists, keep the latest ones.
+#define CHANLIST_CACHE_SIZE 4
+#define CHANLIST_CACHE_TEXT 24
+typedef struct {
+    char text[CHANLIST_CACHE_TEXT];
+    uint8_t len;
+    uint8_t max_channel;
+    relay_mask_t mask;
+} chanlist_cache_t;
+
+static chanlist_cache_t g_chanlist_cache[CHANLIST_CACHE_SIZE];
+static uint32_t g_chanlist_cache_next;
+
+chanlist_result_t chanlist_mask(const char *text, size_t len, uint32_t max_channel, relay_mask_t *mask)
+{
+    for (int i = 0; i < CHANLIST_CACHE_SIZE; i++)
+    {
+        chanlist_cache_t *entry = &g_chanlist_cache[i];
+        if (len > 0 && entry->len == len && entry->max_channel == max_channel &&
+            memcmp(entry->text, text, len) == 0)
+        {
+            *mask = entry->mask;
+            return CHANLIST_OK;
+        }
+    }
+
+    chanlist_result_t res = compile(text, len, max_channel, mask);
+
+    if (res == CHANLIST_OK && len > 0 && len <= CHANLIST_CACHE_TEXT)
+    {
+        chanlist_cache_t *entry = &g_chanlist_cache[g_chanlist_cache_next++ % CHANLIST_CACHE_SIZE];
+        memcpy(entry->text, text, len);
+        entry->len = len;
+        entry->max_channel = max_channel;
+        entry->mask = *mask;
+    }
+
+    return res;
+}
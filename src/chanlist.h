@@ -0,0 +1,33 @@
+// Channel list compiler for SCPI channel list expressions such as (@1,3,5:8).
+// Lists are parsed in a single pass, unlike SCPI_ExprChannelListEntry() which
+// re-scans the expression from the start for every entry.
+// Channels can also be given in two dimensions as card!channel, e.g. (@2!1:2!16),
+// which resolves to the linear channel number, see relays_card_channel().
+
+#pragma once
+
+#include "board.h"
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    CHANLIST_OK = 0,
+    CHANLIST_END,       // No more entries
+    CHANLIST_SYNTAX,    // Malformed expression
+    CHANLIST_RANGE      // Channel number out of range
+} chanlist_result_t;
+
+typedef struct {
+    const char *pos;
+    const char *end;
+} chanlist_iter_t;
+
+// Start iterating entries of a channel list expression
+chanlist_result_t chanlist_begin(chanlist_iter_t *iter, const char *text, size_t len);
+
+// Get next entry as linear channel numbers, first > last for descending ranges.
+chanlist_result_t chanlist_next(chanlist_iter_t *iter, uint32_t *first, uint32_t *last);
+
+// Compile channel list into a bitmask of channels 1..max_channel (at most RELAY_COUNT).
+// Recently compiled lists are cached by their text.
+chanlist_result_t chanlist_mask(const char *text, size_t len, uint32_t max_channel, relay_mask_t *mask);
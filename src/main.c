@@ -1,5 +1,6 @@
 #include "board.h"
 #include "usb_serial.h"
+#include "presets.h"
 #include <stm32f0xx_hal.h>
 
 void poll_buttons()
@@ -14,7 +15,7 @@ void poll_buttons()
     else if (buttons & BTN_CYCLE)
     {
         // Activate next relay in sequence
-        uint32_t relays = relays_get_state();
+        relay_mask_t relays = relays_get_state();
         relays = (relays << 1) & RELAY_MASK;
         if (relays == 0)
             relays = 1;
@@ -26,17 +27,32 @@ void poll_buttons()
     }
 }
 
+// Main logic runs whenever an interrupt calls board_wake(): after USB
+// reception, button release or relays settling. Being the lowest priority
+// handler, it can block while waiting for USB and SysTick interrupts.
+void PendSV_Handler()
+{
+    poll_buttons();
+    usb_serial_poll();
+    presets_poll();
+}
+
 int main()
 {
     board_init();
     STATUS_LED_ON();
     set_relay_pwr(true);
 
+    relay_mask_t power_on_state;
+    if (presets_init(&power_on_state))
+        relays_set_state(power_on_state, false);
+
     usb_serial_start();
+    board_wake();
 
     while (1)
     {
-        poll_buttons();
-        usb_serial_poll();
+        // Sleep between events
+        __WFI();
     }
 }
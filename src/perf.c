@@ -0,0 +1,53 @@
+#include "perf.h"
+#include <stm32f0xx_hal.h>
+#include <string.h>
+
+static perf_stats_t g_perf[PERF_STAGE_COUNT];
+
+void perf_init()
+{
+    perf_reset();
+}
+
+void perf_record(perf_stage_t stage, uint32_t start)
+{
+    uint32_t elapsed = perf_now() - start;
+
+    uint32_t bin = 0;
+    if (elapsed > 0)
+    {
+        bin = 32 - __builtin_clz(elapsed);
+        if (bin >= PERF_HIST_BINS) bin = PERF_HIST_BINS - 1;
+    }
+
+    // Stages can be recorded both from main loop and interrupts
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    perf_stats_t *s = &g_perf[stage];
+    s->count++;
+    s->sum += elapsed;
+    if (elapsed < s->min) s->min = elapsed;
+    if (elapsed > s->max) s->max = elapsed;
+    if (s->hist[bin] != 0xFFFF) s->hist[bin]++;
+
+    __set_PRIMASK(primask);
+}
+
+void perf_get(perf_stage_t stage, perf_stats_t *stats)
+{
+    __disable_irq();
+    *stats = g_perf[stage];
+    __enable_irq();
+}
+
+void perf_reset()
+{
+    __disable_irq();
+    memset(g_perf, 0, sizeof(g_perf));
+    for (int i = 0; i < PERF_STAGE_COUNT; i++)
+    {
+        g_perf[i].min = UINT32_MAX;
+    }
+    __enable_irq();
+}
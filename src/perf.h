@@ -0,0 +1,60 @@
+// Latency statistics for firmware hot paths.
+// Cortex-M0 has no cycle counter, so timestamps combine the millisecond tick
+// with the SysTick down-counter, which runs at HCLK.
+
+#pragma once
+
+#include <stdint.h>
+#include <stm32f042x6.h>
+#include <stm32f0xx_hal.h>
+
+#define PERF_HCLK_MHZ 48
+
+typedef enum {
+    PERF_RX = 0,    // USB packet received -> passed to scpi_dispatch_input()
+    PERF_PARSE,     // scpi_dispatch_input(), including command callbacks
+    PERF_ENQUEUE,   // Queueing of a relay step
+    PERF_ACTUATE,   // Relay step queued -> relay pins driven
+    PERF_TX,        // USB IN transfer started -> completed by host
+    PERF_STAGE_COUNT
+} perf_stage_t;
+
+// Bin 0 counts latencies of 0 us, bin n counts [2^(n-1), 2^n) us.
+// Last bin also counts everything longer.
+#define PERF_HIST_BINS 20
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint16_t hist[PERF_HIST_BINS]; // Saturates at 65535
+} perf_stats_t;
+
+void perf_init();
+
+// Current time in microseconds, wraps around after 71 minutes
+static inline uint32_t perf_now()
+{
+    uint32_t ms, val, pending;
+    do
+    {
+        ms = HAL_GetTick();
+        val = SysTick->VAL;
+
+        // Counter has reloaded, but tick interrupt is masked or not yet run
+        pending = SCB->ICSR & SCB_ICSR_PENDSTSET_Msk;
+        if (pending) val = SysTick->VAL;
+    } while (ms != HAL_GetTick());
+
+    if (pending) ms++;
+    return ms * 1000 + (SysTick->LOAD - val) / PERF_HCLK_MHZ;
+}
+
+// Record time elapsed since start. May be called from interrupts.
+void perf_record(perf_stage_t stage, uint32_t start);
+
+// Take consistent copy of statistics for a stage
+void perf_get(perf_stage_t stage, perf_stats_t *stats);
+
+void perf_reset();
@@ -0,0 +1,426 @@
+#include "presets.h"
+#include "board.h"
+#include "scan.h"
+#include "routes.h"
+#include <string.h>
+
+// Flash log format: each page starts with a header record holding its
+// generation, followed by records appended in the order slots were saved.
+// The valid page with the newest generation is active and the last record
+// of each slot in it wins. When the active page is full, current values of
+// all slots are copied to the next page, so erases rotate through the pages.
+// Records interrupted by power loss fail their check and are skipped.
+#define PRESET_MAGIC      0x5053 // Page header
+#define PRESET_KEY        0xA500 // Slot record, low byte is the slot number
+#define PRESET_KEY_CONFIG 0xA5FF // Settings record
+#define PRESET_KEY_CYCLES 0xA600 // Cycle counter, low byte is the channel
+#define PRESET_KEY_ROUTE  0xA700 // Route mask, low byte is the route slot
+#define PRESET_KEY_ROUTE_NAME 0xA800 // Part of route name, see route_write()
+
+// Dirty bits of g_preset_dirty: one per slot, then settings, then one per route
+#define PRESET_CONFIG     PRESET_COUNT
+#define PRESET_ROUTES     (PRESET_CONFIG + 1)
+
+// Values are as wide as channel masks, so records are 8 bytes
+// up to 32 channels and 12 bytes above.
+#define PRESET_VALUE_HALFWORDS (sizeof(relay_mask_t) / 2)
+
+typedef struct {
+    uint16_t key;
+    uint16_t value[PRESET_VALUE_HALFWORDS];
+    uint16_t check;
+} preset_record_t;
+
+#define PRESET_RECORDS_PER_PAGE (FLASH_PAGE_SIZE / sizeof(preset_record_t))
+
+// A route is stored as its name split over record values, then its mask
+#define PRESET_ROUTE_NAME_RECORDS (ROUTE_NAME_LEN / sizeof(relay_mask_t))
+#define PRESET_ROUTE_RECORDS      (PRESET_ROUTE_NAME_RECORDS + 1)
+
+// Compaction must fit header, slots, settings, counters and routes in one page
+_Static_assert(1 + PRESET_COUNT + 1 + RELAY_COUNT + ROUTE_MAX * PRESET_ROUTE_RECORDS < PRESET_RECORDS_PER_PAGE,
+               "Preset log page too small");
+_Static_assert(PRESET_ROUTES + ROUTE_MAX <= 32, "Too many dirty bits");
+
+static relay_mask_t g_preset_state[PRESET_COUNT];
+static uint32_t g_preset_valid;      // Bit per saved slot
+static bool g_preset_power_on;
+static uint32_t g_preset_dirty;      // Bit per slot not yet written to flash
+static uint32_t g_routes_stored;     // Bit per route slot that flash holds a route for
+static relay_mask_t g_cycles_dirty;  // Bit per cycle counter not yet written
+static uint32_t g_preset_page;       // Active page
+static uint32_t g_preset_next;       // Index of first free record in active page
+static uint16_t g_preset_generation;
+static uint32_t g_cycles_saved[RELAY_COUNT]; // Counts last marked for writing
+static uint32_t g_cycles_saved_at;           // Tick when counts were last marked for writing
+static bool g_compact_waiting;               // Full page waits for relays and scan to be idle
+static uint32_t g_compact_wait_since;
+
+static const preset_record_t *page_records(uint32_t page)
+{
+    return (const preset_record_t *)(uintptr_t)(PRESET_FLASH_ADDR + page * FLASH_PAGE_SIZE);
+}
+
+static uint16_t record_check(uint16_t key, relay_mask_t value)
+{
+    uint16_t check = key;
+    for (uint32_t i = 0; i < PRESET_VALUE_HALFWORDS; i++)
+    {
+        check ^= (uint16_t)(value >> (i * 16));
+    }
+    return ~check;
+}
+
+static relay_mask_t record_value(const preset_record_t *r)
+{
+    relay_mask_t value = 0;
+    for (uint32_t i = 0; i < PRESET_VALUE_HALFWORDS; i++)
+    {
+        value |= (relay_mask_t)r->value[i] << (i * 16);
+    }
+    return value;
+}
+
+static bool record_valid(const preset_record_t *r)
+{
+    return r->check == record_check(r->key, record_value(r));
+}
+
+static bool record_erased(const preset_record_t *r)
+{
+    const uint16_t *data = (const uint16_t *)r;
+    for (uint32_t i = 0; i < sizeof(preset_record_t) / 2; i++)
+    {
+        if (data[i] != 0xFFFF) return false;
+    }
+    return true;
+}
+
+// Program one record, flash must be unlocked
+static void record_write(uint32_t page, uint32_t index, uint16_t key, relay_mask_t value)
+{
+    uint32_t addr = PRESET_FLASH_ADDR + page * FLASH_PAGE_SIZE + index * sizeof(preset_record_t);
+
+    HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, addr, key);
+    for (uint32_t i = 0; i < PRESET_VALUE_HALFWORDS; i++)
+    {
+        HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, addr + 2 + i * 2, (uint16_t)(value >> (i * 16)));
+    }
+    HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, addr + sizeof(preset_record_t) - 2,
+                      record_check(key, value));
+}
+
+// Write a persistent route, or a cleared first name record if the slot
+// no longer has one. Returns the index after the written records.
+static uint32_t route_write(uint32_t page, uint32_t next, uint32_t slot)
+{
+    const route_t *route = routes_get(slot);
+    uint16_t name_key = PRESET_KEY_ROUTE_NAME | (slot * PRESET_ROUTE_NAME_RECORDS);
+
+    if (!route || !route->persistent)
+    {
+        record_write(page, next++, name_key, 0);
+        g_routes_stored &= ~(1 << slot);
+        return next;
+    }
+
+    for (uint32_t i = 0; i < PRESET_ROUTE_NAME_RECORDS; i++)
+    {
+        relay_mask_t value;
+        memcpy(&value, route->name + i * sizeof(relay_mask_t), sizeof(relay_mask_t));
+        record_write(page, next++, name_key + i, value);
+    }
+    record_write(page, next++, PRESET_KEY_ROUTE | slot, route->mask);
+    g_routes_stored |= 1 << slot;
+    return next;
+}
+
+// Number of records that records_write() appends
+static uint32_t records_count(uint32_t slots, relay_mask_t cycles)
+{
+    uint32_t count = __builtin_popcount(slots & ((1 << PRESET_ROUTES) - 1)) + RELAY_POPCOUNT(cycles);
+    for (uint32_t slot = 0; slot < ROUTE_MAX; slot++)
+    {
+        if ((slots >> (PRESET_ROUTES + slot)) & 1)
+            count += routes_get(slot) ? PRESET_ROUTE_RECORDS : 1;
+    }
+    return count;
+}
+
+// Append records of the given slots, routes and counters starting at index next,
+// returns the index after them. Flash must be unlocked.
+static uint32_t records_write(uint32_t page, uint32_t next, uint32_t slots, relay_mask_t cycles)
+{
+    for (uint32_t slot = 0; slot < PRESET_COUNT; slot++)
+    {
+        if ((slots >> slot) & 1)
+            record_write(page, next++, PRESET_KEY | slot, g_preset_state[slot]);
+    }
+
+    if ((slots >> PRESET_CONFIG) & 1)
+        record_write(page, next++, PRESET_KEY_CONFIG, g_preset_power_on ? 1 : 0);
+
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if (cycles & RELAY_BIT(i))
+            record_write(page, next++, PRESET_KEY_CYCLES | i, g_cycles_saved[i]);
+    }
+
+    for (uint32_t slot = 0; slot < ROUTE_MAX; slot++)
+    {
+        if ((slots >> (PRESET_ROUTES + slot)) & 1)
+            next = route_write(page, next, slot);
+    }
+
+    return next;
+}
+
+bool presets_init(relay_mask_t *power_on_state)
+{
+    bool found = false;
+    char route_names[ROUTE_MAX][ROUTE_NAME_LEN] = {{0}};
+    relay_mask_t route_masks[ROUTE_MAX] = {0};
+
+    // Flash contents replace RAM state, as after a power cycle
+    memset(g_preset_state, 0, sizeof(g_preset_state));
+    memset(g_cycles_saved, 0, sizeof(g_cycles_saved));
+    g_preset_valid = 0;
+    g_preset_power_on = false;
+    g_preset_dirty = 0;
+    g_routes_stored = 0;
+    g_cycles_dirty = 0;
+
+    for (uint32_t page = 0; page < PRESET_FLASH_PAGES; page++)
+    {
+        const preset_record_t *header = page_records(page);
+        if (header->key != PRESET_MAGIC || !record_valid(header))
+            continue;
+
+        // Generation wraps around, compare by difference
+        if (!found || (int16_t)(header->value[0] - g_preset_generation) > 0)
+        {
+            g_preset_page = page;
+            g_preset_generation = header->value[0];
+            found = true;
+        }
+    }
+
+    if (!found)
+    {
+        // Blank or corrupted area, first save starts the log on page 0
+        g_preset_page = PRESET_FLASH_PAGES - 1;
+        g_preset_next = PRESET_RECORDS_PER_PAGE;
+    }
+    else
+    {
+        const preset_record_t *records = page_records(g_preset_page);
+        uint32_t i;
+
+        for (i = 1; i < PRESET_RECORDS_PER_PAGE && !record_erased(&records[i]); i++)
+        {
+            const preset_record_t *r = &records[i];
+            uint32_t slot = r->key & 0xFF;
+
+            if (!record_valid(r))
+                continue;
+
+            if (r->key == PRESET_KEY_CONFIG)
+            {
+                g_preset_power_on = record_value(r) & 1;
+            }
+            else if ((r->key & 0xFF00) == PRESET_KEY && slot < PRESET_COUNT)
+            {
+                g_preset_state[slot] = record_value(r) & RELAY_MASK;
+                g_preset_valid |= 1 << slot;
+            }
+            else if ((r->key & 0xFF00) == PRESET_KEY_CYCLES && slot < RELAY_COUNT)
+            {
+                g_cycles_saved[slot] = record_value(r);
+                relays_set_cycles(slot, g_cycles_saved[slot]);
+            }
+            else if ((r->key & 0xFF00) == PRESET_KEY_ROUTE && slot < ROUTE_MAX)
+            {
+                route_masks[slot] = record_value(r);
+            }
+            else if ((r->key & 0xFF00) == PRESET_KEY_ROUTE_NAME &&
+                     slot < ROUTE_MAX * PRESET_ROUTE_NAME_RECORDS)
+            {
+                relay_mask_t value = record_value(r);
+                memcpy(&route_names[0][0] + slot * sizeof(relay_mask_t), &value, sizeof(relay_mask_t));
+            }
+        }
+
+        g_preset_next = i;
+    }
+
+    for (uint32_t slot = 0; slot < ROUTE_MAX; slot++)
+    {
+        if (route_names[slot][0])
+        {
+            routes_restore(slot, route_names[slot], route_masks[slot]);
+            g_routes_stored |= 1 << slot;
+        }
+    }
+
+    g_cycles_saved_at = HAL_GetTick();
+    *power_on_state = g_preset_state[0];
+    return g_preset_power_on && (g_preset_valid & 1);
+}
+
+void presets_save(uint32_t slot, relay_mask_t state)
+{
+    g_preset_state[slot] = state & RELAY_MASK;
+    g_preset_valid |= 1 << slot;
+    g_preset_dirty |= 1 << slot;
+}
+
+bool presets_load(uint32_t slot, relay_mask_t *state)
+{
+    *state = g_preset_state[slot];
+    return (g_preset_valid >> slot) & 1;
+}
+
+void presets_set_power_on(bool enable)
+{
+    if (enable != g_preset_power_on)
+    {
+        g_preset_power_on = enable;
+        g_preset_dirty |= 1 << PRESET_CONFIG;
+    }
+}
+
+bool presets_get_power_on()
+{
+    return g_preset_power_on;
+}
+
+void presets_save_route(uint32_t slot)
+{
+    const route_t *route = routes_get(slot);
+    if ((route && route->persistent) || ((g_routes_stored >> slot) & 1))
+        g_preset_dirty |= 1 << (PRESET_ROUTES + slot);
+}
+
+// Copy all slots to the next page, flash must be unlocked
+static void presets_compact()
+{
+    uint32_t page = (g_preset_page + 1) % PRESET_FLASH_PAGES;
+    uint32_t error;
+    FLASH_EraseInitTypeDef erase = {
+        .TypeErase = FLASH_TYPEERASE_PAGES,
+        .PageAddress = PRESET_FLASH_ADDR + page * FLASH_PAGE_SIZE,
+        .NbPages = 1,
+    };
+
+    if (HAL_FLASHEx_Erase(&erase, &error) != HAL_OK)
+        return;
+
+    // Routes that are not persistent are left out, so need no cleared record
+    uint32_t routes = 0;
+    for (uint32_t slot = 0; slot < ROUTE_MAX; slot++)
+    {
+        const route_t *route = routes_get(slot);
+        if (route && route->persistent) routes |= 1 << (PRESET_ROUTES + slot);
+    }
+
+    g_routes_stored = 0;
+    uint32_t next = records_write(page, 1, g_preset_valid | (1 << PRESET_CONFIG) | routes, RELAY_MASK);
+
+    // Header goes last, so the old page stays active if this is interrupted
+    g_preset_generation++;
+    record_write(page, 0, PRESET_MAGIC, g_preset_generation);
+    g_preset_page = page;
+    g_preset_next = next;
+}
+
+// Mark changed cycle counters for writing when they are due
+static void presets_poll_cycles()
+{
+    uint32_t now = HAL_GetTick();
+    relay_mask_t changed = 0;
+    uint32_t most = 0;
+
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        uint32_t count = relays_get_cycles(i) - g_cycles_saved[i];
+        if (count != 0) changed |= RELAY_BIT(i);
+        if (count > most) most = count;
+    }
+
+    if (!changed)
+        return;
+
+    uint32_t elapsed = now - g_cycles_saved_at;
+    uint32_t interval = (most >= PRESET_CYCLES_THRESHOLD) ?
+        PRESET_CYCLES_MIN_INTERVAL_MS : PRESET_CYCLES_INTERVAL_MS;
+
+    if (elapsed < interval)
+    {
+        // Counts that reach the threshold meanwhile are seen when relay
+        // commands or scan steps run the main logic
+        board_wake_at(g_cycles_saved_at + interval);
+        return;
+    }
+
+    // Writing while relays settle could delay their SysTick processing.
+    // SysTick runs the main logic when they have settled, but continuous
+    // switching must not postpone the write forever.
+    if (relays_busy() && elapsed - interval < PRESET_MAX_DEFER_MS)
+    {
+        board_wake_at(g_cycles_saved_at + interval + PRESET_MAX_DEFER_MS);
+        return;
+    }
+
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        g_cycles_saved[i] = relays_get_cycles(i);
+    }
+
+    g_cycles_dirty |= changed;
+    g_cycles_saved_at = now;
+}
+
+void presets_poll()
+{
+    presets_poll_cycles();
+
+    if (!g_preset_dirty && !g_cycles_dirty)
+        return;
+
+    // Appending takes a few hundred microseconds. A page erase stalls
+    // everything running from flash, including interrupts, so it waits
+    // until it cannot delay relay timing or a scan step. If they never go
+    // idle, the erase goes ahead anyway: SysTick is held off meanwhile,
+    // which only lengthens settle and dwell times.
+    uint32_t count = records_count(g_preset_dirty, g_cycles_dirty);
+    bool full = g_preset_next + count > PRESET_RECORDS_PER_PAGE;
+    if (full && (relays_busy() || scan_running()))
+    {
+        uint32_t now = HAL_GetTick();
+        if (!g_compact_waiting)
+        {
+            g_compact_waiting = true;
+            g_compact_wait_since = now;
+        }
+
+        if (now - g_compact_wait_since < PRESET_MAX_DEFER_MS)
+        {
+            board_wake_at(g_compact_wait_since + PRESET_MAX_DEFER_MS);
+            return;
+        }
+    }
+    g_compact_waiting = false;
+
+    HAL_FLASH_Unlock();
+
+    if (full)
+        presets_compact();
+    else
+        g_preset_next = records_write(g_preset_page, g_preset_next, g_preset_dirty, g_cycles_dirty);
+
+    HAL_FLASH_Lock();
+
+    // Flash errors are not retried, RAM slots stay valid until power-off
+    g_preset_dirty = 0;
+    g_cycles_dirty = 0;
+}
@@ -0,0 +1,49 @@
+// Stored relay states for *SAV and *RCL, kept in RAM and persisted to a
+// log in the flash pages reserved by PRESET_FLASH_ADDR. The log also
+// holds the relay cycle counters of board.c and persistent routes of routes.c.
+
+#pragma once
+
+#include "board.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PRESET_COUNT 10 // Slots 0..9, slot 0 is the power-on state
+
+// Changed cycle counters are written once per interval, or after the
+// shorter one once a channel has operated PRESET_CYCLES_THRESHOLD times
+// since the last write. Continuous switching then costs one page erase per
+// ~2 hours. Counts since the last write are lost if power is removed.
+#define PRESET_CYCLES_INTERVAL_MS     3600000
+#define PRESET_CYCLES_MIN_INTERVAL_MS 600000
+#define PRESET_CYCLES_THRESHOLD       1000
+
+// Counter writes and page erases wait for relays and scan to be idle,
+// but for at most this long
+#define PRESET_MAX_DEFER_MS 10000
+
+// Load slots, relay cycle counters and routes from flash, replacing the
+// slots in RAM. Returns true and the state of slot 0 if it should be
+// recalled at power-on.
+bool presets_init(relay_mask_t *power_on_state);
+
+// Store state in a slot. Takes effect immediately, the flash write
+// is done later by presets_poll().
+void presets_save(uint32_t slot, relay_mask_t state);
+
+// Returns false if the slot has never been saved
+bool presets_load(uint32_t slot, relay_mask_t *state);
+
+// Recall slot 0 at power-on
+void presets_set_power_on(bool enable);
+bool presets_get_power_on();
+
+// Write route slot to flash after it has been defined or deleted,
+// if it is persistent or flash still holds an earlier definition
+void presets_save_route(uint32_t slot);
+
+// Write changed slots and, once per interval, changed cycle counters to
+// flash. Called from main logic after commands have been processed.
+// Page erases, which stall the CPU for tens of milliseconds, are
+// postponed until relays and scan are idle.
+void presets_poll();
@@ -0,0 +1,161 @@
+#include "routes.h"
+#include <string.h>
+
+static route_t g_routes[ROUTE_MAX];
+
+// Slot + 1 of the route hashed here, 0 if empty. Collisions are resolved
+// by linear probing, and the table is rebuilt when a route is deleted.
+static uint8_t g_route_hash[ROUTE_HASH_SLOTS];
+
+static char to_upper(char c)
+{
+    return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+static bool name_valid(const char *name, size_t len)
+{
+    if (len < 1 || len > ROUTE_NAME_LEN)
+        return false;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = to_upper(name[i]);
+        bool letter = (c >= 'A' && c <= 'Z');
+        bool digit = (c >= '0' && c <= '9') || c == '_';
+        if (!letter && (i == 0 || !digit))
+            return false;
+    }
+    return true;
+}
+
+// FNV-1a of the upper case name
+static uint32_t name_hash(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint8_t)to_upper(name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+size_t routes_name_len(const route_t *route)
+{
+    size_t len = 0;
+    while (len < ROUTE_NAME_LEN && route->name[len]) len++;
+    return len;
+}
+
+static bool name_equal(const route_t *route, const char *name, size_t len)
+{
+    if (routes_name_len(route) != len)
+        return false;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (route->name[i] != to_upper(name[i])) return false;
+    }
+    return true;
+}
+
+// Returns slot of the route, -1 if not defined
+static int route_find(const char *name, size_t len)
+{
+    uint32_t h = name_hash(name, len);
+    for (uint32_t i = 0; i < ROUTE_HASH_SLOTS; i++)
+    {
+        uint8_t entry = g_route_hash[(h + i) % ROUTE_HASH_SLOTS];
+        if (entry == 0)
+            return -1;
+        if (name_equal(&g_routes[entry - 1], name, len))
+            return entry - 1;
+    }
+    return -1;
+}
+
+static void hash_insert(uint32_t slot)
+{
+    const route_t *route = &g_routes[slot];
+    uint32_t h = name_hash(route->name, routes_name_len(route));
+    while (g_route_hash[h % ROUTE_HASH_SLOTS] != 0) h++;
+    g_route_hash[h % ROUTE_HASH_SLOTS] = slot + 1;
+}
+
+static void route_store(uint32_t slot, const char *name, size_t len, relay_mask_t mask, bool persistent)
+{
+    route_t *route = &g_routes[slot];
+    memset(route->name, 0, ROUTE_NAME_LEN);
+    for (size_t i = 0; i < len; i++)
+    {
+        route->name[i] = to_upper(name[i]);
+    }
+    route->mask = mask & RELAY_MASK;
+    route->persistent = persistent;
+}
+
+int routes_define(const char *name, size_t len, relay_mask_t mask, bool persistent)
+{
+    if (!name_valid(name, len))
+        return -1;
+
+    int slot = route_find(name, len);
+    if (slot >= 0)
+    {
+        // Name is unchanged, so is its place in the hash table
+        g_routes[slot].mask = mask & RELAY_MASK;
+        g_routes[slot].persistent = persistent;
+        return slot;
+    }
+
+    for (slot = 0; slot < ROUTE_MAX && g_routes[slot].name[0]; slot++);
+    if (slot == ROUTE_MAX)
+        return -1;
+
+    route_store(slot, name, len, mask, persistent);
+    hash_insert(slot);
+    return slot;
+}
+
+int routes_delete(const char *name, size_t len)
+{
+    int slot = route_find(name, len);
+    if (slot < 0)
+        return -1;
+
+    g_routes[slot].name[0] = 0;
+
+    // Rebuilding keeps probe sequences unbroken without tombstones
+    memset(g_route_hash, 0, sizeof(g_route_hash));
+    for (uint32_t i = 0; i < ROUTE_MAX; i++)
+    {
+        if (g_routes[i].name[0]) hash_insert(i);
+    }
+    return slot;
+}
+
+bool routes_lookup(const char *name, size_t len, relay_mask_t *mask)
+{
+    int slot = route_find(name, len);
+    if (slot < 0)
+        return false;
+
+    *mask = g_routes[slot].mask;
+    return true;
+}
+
+const route_t *routes_get(uint32_t slot)
+{
+    return g_routes[slot].name[0] ? &g_routes[slot] : NULL;
+}
+
+void routes_restore(uint32_t slot, const char *name, relay_mask_t mask)
+{
+    size_t len = 0;
+    while (len < ROUTE_NAME_LEN && name[len]) len++;
+
+    if (!name_valid(name, len) || route_find(name, len) >= 0 || g_routes[slot].name[0])
+        return;
+
+    route_store(slot, name, len, mask, true);
+    hash_insert(slot);
+}
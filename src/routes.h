@@ -0,0 +1,47 @@
+// Named channel lists for ROUTe:DEFine. Each name maps to its compiled
+// channel mask through a small open-addressed hash table, so commands
+// can use a name in place of a channel list without any list parsing.
+// Routes marked persistent are written to flash by presets.c.
+
+#pragma once
+
+#include "board.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Fewer routes on large boards, so that the preset log still compacts
+// into one page next to the per-channel cycle counters.
+#if RELAY_COUNT > 32
+#define ROUTE_MAX 4
+#else
+#define ROUTE_MAX 8
+#endif
+
+#define ROUTE_NAME_LEN    8  // Letters, digits and underscore, starts with a letter
+#define ROUTE_HASH_SLOTS  16 // Power of two, at least ROUTE_MAX
+
+typedef struct {
+    char name[ROUTE_NAME_LEN]; // Upper case, not terminated at full length, empty if unused
+    relay_mask_t mask;
+    bool persistent;
+} route_t;
+
+// Define or redefine a route. Returns its slot, or -1 if the name
+// is invalid or all slots are in use.
+int routes_define(const char *name, size_t len, relay_mask_t mask, bool persistent);
+
+// Returns slot of the deleted route, or -1 if there is no such route
+int routes_delete(const char *name, size_t len);
+
+// Case-insensitive lookup, returns false if the name is not defined
+bool routes_lookup(const char *name, size_t len, relay_mask_t *mask);
+
+// Returns route in slot 0..ROUTE_MAX-1, NULL if the slot is unused
+const route_t *routes_get(uint32_t slot);
+
+// Put a persistent route loaded from flash into its original slot
+void routes_restore(uint32_t slot, const char *name, relay_mask_t mask);
+
+// Returns length of the name, which is not always terminated
+size_t routes_name_len(const route_t *route);
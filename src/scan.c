@@ -0,0 +1,235 @@
+#include "scan.h"
+#include "board.h"
+
+static relay_mask_t g_scan_list[SCAN_MAX_STEPS];
+static uint32_t g_scan_len;
+static uint32_t g_scan_dwell = SCAN_DEFAULT_DWELL_MS;
+static uint32_t g_scan_count = 1;
+static scan_trigger_t g_scan_source = SCAN_TRIG_IMMEDIATE;
+static uint32_t g_scan_delay;
+
+static volatile bool g_scan_running;
+static volatile bool g_scan_settling;   // Waiting for relays of current step
+static volatile relay_mask_t g_scan_closed; // Channels closed by current step
+static volatile uint32_t g_scan_step;
+static volatile uint32_t g_scan_pass;
+static volatile uint32_t g_scan_next;   // Tick when dwell of current step ends
+static volatile bool g_scan_waiting;    // Dwell has passed, waiting for trigger
+static volatile bool g_scan_triggered;  // Trigger accepted, step follows at g_scan_next
+
+bool scan_set_list(const relay_mask_t *steps, uint32_t count)
+{
+    if (g_scan_running || count > SCAN_MAX_STEPS)
+        return false;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!(steps[i] & RELAY_MASK))
+            return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        g_scan_list[i] = steps[i] & RELAY_MASK;
+    }
+
+    g_scan_len = count;
+    return true;
+}
+
+uint32_t scan_get_list(const relay_mask_t **steps)
+{
+    *steps = g_scan_list;
+    return g_scan_len;
+}
+
+void scan_set_dwell(uint32_t dwell_ms)
+{
+    g_scan_dwell = dwell_ms;
+}
+
+uint32_t scan_get_dwell()
+{
+    return g_scan_dwell;
+}
+
+void scan_set_count(uint32_t count)
+{
+    g_scan_count = count;
+}
+
+uint32_t scan_get_count()
+{
+    return g_scan_count;
+}
+
+void scan_set_trigger_source(scan_trigger_t source)
+{
+    __disable_irq();
+    g_scan_source = source;
+    if (source == SCAN_TRIG_IMMEDIATE)
+    {
+        // Scan continues on its next tick without a trigger
+        g_scan_waiting = false;
+    }
+    __enable_irq();
+
+    trigger_input_enable(source == SCAN_TRIG_EXTERNAL);
+}
+
+scan_trigger_t scan_get_trigger_source()
+{
+    return g_scan_source;
+}
+
+void scan_set_trigger_delay(uint32_t delay_ms)
+{
+    g_scan_delay = delay_ms;
+}
+
+uint32_t scan_get_trigger_delay()
+{
+    return g_scan_delay;
+}
+
+void scan_trigger()
+{
+    __disable_irq();
+    if (g_scan_running && g_scan_waiting)
+    {
+        // Extra tick waits at least the full delay, as with HAL_Delay()
+        g_scan_waiting = false;
+        g_scan_triggered = true;
+        g_scan_next = HAL_GetTick() + (g_scan_delay ? g_scan_delay + 1 : 0);
+    }
+    __enable_irq();
+}
+
+bool scan_waiting_trigger()
+{
+    return g_scan_running && g_scan_waiting;
+}
+
+bool scan_list_valid(relay_mask_t state)
+{
+    for (uint32_t i = 0; i < g_scan_len; i++)
+    {
+        if (!mux_state_valid(state | g_scan_list[i]))
+            return false;
+    }
+    return true;
+}
+
+bool scan_start()
+{
+    if (g_scan_running || g_scan_len == 0)
+        return false;
+
+    g_scan_step = 0;
+    g_scan_pass = 0;
+    g_scan_closed = 0;
+    g_scan_settling = false;
+    g_scan_waiting = false;
+    g_scan_triggered = false;
+    g_scan_next = HAL_GetTick();
+    g_scan_running = true;
+    return true;
+}
+
+void scan_abort()
+{
+    __disable_irq();
+    relay_mask_t closed = g_scan_closed;
+    g_scan_running = false;
+    g_scan_waiting = false;
+    g_scan_closed = 0;
+    __enable_irq();
+
+    if (closed)
+    {
+        open_relays(closed);
+    }
+}
+
+bool scan_running()
+{
+    return g_scan_running;
+}
+
+void scan_get_progress(uint32_t *step, uint32_t *pass)
+{
+    __disable_irq();
+    *step = g_scan_step;
+    *pass = g_scan_pass;
+    __enable_irq();
+}
+
+void scan_tick()
+{
+    if (!g_scan_running)
+        return;
+
+    if (relays_busy())
+    {
+        // Other relay commands delay the scan, it is not waiting for a
+        // trigger until they have settled and the check below runs again
+        g_scan_waiting = false;
+        return;
+    }
+
+    uint32_t now = HAL_GetTick();
+    if (g_scan_settling)
+    {
+        // Relays of current step have settled, start dwell time
+        g_scan_settling = false;
+        g_scan_next = now + g_scan_dwell;
+    }
+
+    if ((int32_t)(now - g_scan_next) < 0)
+        return;
+
+    // Each step, including the first one, waits for its trigger.
+    // Finishing the last pass does not.
+    bool last = g_scan_closed && g_scan_step + 1 >= g_scan_len &&
+                g_scan_count != 0 && g_scan_pass + 1 >= g_scan_count;
+    if (g_scan_source != SCAN_TRIG_IMMEDIATE && !g_scan_triggered && !last)
+    {
+        g_scan_waiting = true;
+        return;
+    }
+    g_scan_waiting = false;
+    g_scan_triggered = false;
+
+    if (g_scan_closed)
+    {
+        // Break previous step before making the next one. Operate and
+        // release times are worst-case settle times, not minimums, so the
+        // make cannot safely overlap the break: a step costs both.
+        open_relays(g_scan_closed);
+        g_scan_closed = 0;
+
+        if (++g_scan_step >= g_scan_len)
+        {
+            g_scan_step = 0;
+            g_scan_pass++;
+
+            if (g_scan_count != 0 && g_scan_pass >= g_scan_count)
+            {
+                g_scan_running = false;
+                return;
+            }
+        }
+    }
+
+    // Channels closed by other commands during the scan can conflict with
+    // the step in exclusive mux mode, then the scan stops before it
+    if (!mux_state_valid(relays_get_state() | g_scan_list[g_scan_step]))
+    {
+        g_scan_running = false;
+        return;
+    }
+
+    g_scan_closed = g_scan_list[g_scan_step];
+    close_relays(g_scan_closed);
+    g_scan_settling = true;
+}
@@ -0,0 +1,63 @@
+// Scan list engine: steps through a stored channel sequence from SysTick.
+
+#pragma once
+
+#include "board.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCAN_MAX_STEPS 32
+#define SCAN_DEFAULT_DWELL_MS 0
+#define SCAN_MAX_DWELL_MS 3600000
+
+// Store sequence of channel masks, each closed in turn.
+// Returns false if scan is running or a step has no channels.
+bool scan_set_list(const relay_mask_t *steps, uint32_t count);
+uint32_t scan_get_list(const relay_mask_t **steps);
+
+// Time to stay on each step after relays have settled
+void scan_set_dwell(uint32_t dwell_ms);
+uint32_t scan_get_dwell();
+
+// Number of passes through the list, 0 = infinite
+void scan_set_count(uint32_t count);
+uint32_t scan_get_count();
+
+// What advances the scan to its next step
+typedef enum {
+    SCAN_TRIG_IMMEDIATE = 0, // As soon as dwell time has passed
+    SCAN_TRIG_BUS,           // *TRG command
+    SCAN_TRIG_EXTERNAL,      // Rising edge on trigger input
+} scan_trigger_t;
+
+void scan_set_trigger_source(scan_trigger_t source);
+scan_trigger_t scan_get_trigger_source();
+
+// Time from accepted BUS or EXTernal trigger to switching
+void scan_set_trigger_delay(uint32_t delay_ms);
+uint32_t scan_get_trigger_delay();
+
+// Accept trigger if the scan is waiting for one, otherwise ignore it.
+// Called from main context or from the trigger input interrupt.
+void scan_trigger();
+
+// True if the scan waits for a BUS or EXTernal trigger
+bool scan_waiting_trigger();
+
+// False if a step closed on top of state would violate mux exclusivity
+bool scan_list_valid(relay_mask_t state);
+
+// Start scan from first step, returns false if already running or list is empty.
+bool scan_start();
+
+// Stop scan and open the channel closed by it
+void scan_abort();
+
+bool scan_running();
+
+// Current step index (0-based) and number of completed passes
+void scan_get_progress(uint32_t *step, uint32_t *pass);
+
+// Advance scan, called from SysTick after relay queue processing and
+// from the trigger input interrupt, which has the same priority.
+void scan_tick();
@@ -1,60 +1,175 @@
 #include "scpi_commands.h"
+#include "scan.h"
+#include "perf.h"
+#include "chanlist.h"
+#include "presets.h"
+#include "routes.h"
 
-// Close or open switches based on SCPI standard channel list.
-// Examples:
-//   ROUTE:CLOSE (@1,2)
-//   ROUTE:OPEN (@1:4)
-//   ROUTE:CLOSE? (@1)
-scpi_result_t SCPI_ROUTe_OpenClose(scpi_t *context)
+// Report channel list compiler errors, returns true on success
+static scpi_bool_t chanlist_check(scpi_t *context, chanlist_result_t res)
+{
+    if (res == CHANLIST_RANGE)
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+    else if (res == CHANLIST_SYNTAX)
+        SCPI_ErrorPush(context, SCPI_ERROR_EXPRESSION_PARSING_ERROR);
+
+    return res == CHANLIST_OK || res == CHANLIST_END;
+}
+
+// Route names start with a letter, channel lists with "(@"
+static bool param_is_route(const scpi_parameter_t *param)
+{
+    char c = (param->len > 0) ? param->ptr[0] : 0;
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+// Look up route name given in place of a channel list, see ROUTe:DEFine
+static scpi_bool_t param_route_mask(scpi_t *context, const scpi_parameter_t *param, relay_mask_t *channel_mask)
+{
+    if (!routes_lookup(param->ptr, param->len, channel_mask))
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Parse SCPI channel list parameter or route name into a bitmask of channels.
+static scpi_bool_t param_channel_mask(scpi_t *context, relay_mask_t *channel_mask, scpi_bool_t mandatory)
 {
     scpi_parameter_t param;
-    scpi_bool_t is_range = false;
-    int32_t from_ch = 0, to_ch = 0;
-    uint32_t channel_mask = 0;
-    int index = 0;
-    size_t dimensions;
 
-    if (!SCPI_Parameter(context, &param, TRUE))
-        return SCPI_RES_ERR;
+    *channel_mask = 0;
+    if (!SCPI_Parameter(context, &param, mandatory))
+        return FALSE;
+
+    if (param_is_route(&param))
+        return param_route_mask(context, &param, channel_mask);
+
+    return chanlist_check(context, chanlist_mask(param.ptr, param.len, RELAY_COUNT, channel_mask));
+}
+
+// Between ROUTe:BEGin and ROUTe:COMMit, relay commands only update the
+// pending state, which is then applied as one transition.
+static bool g_route_transaction;
+static relay_mask_t g_route_pending;
+
+// State that relay commands modify and queries report
+static relay_mask_t route_state()
+{
+    return g_route_transaction ? g_route_pending : relays_get_state();
+}
+
+bool scpi_route_transaction_open(void)
+{
+    return g_route_transaction;
+}
+
+static void route_apply(relay_mask_t target, bool make_before_break)
+{
+    if (g_route_transaction)
+        g_route_pending = target & RELAY_MASK;
+    else
+        relays_set_state(target & RELAY_MASK, make_before_break);
+}
+
+// Channel states as a number are 64-bit on boards with more than 32 channels
+#if RELAY_COUNT > 32
+#define param_relay_mask SCPI_ParamUInt64
+#define result_relay_mask SCPI_ResultUInt64
+#else
+#define param_relay_mask SCPI_ParamUInt32
+#define result_relay_mask SCPI_ResultUInt32
+#endif
+
+// Append channel number to a "(@..." list being built, returns new length
+static int append_channel(char *channel_list, int len, int channel)
+{
+    char digits[4];
+    int count = 0;
+
+    if (len > 2) channel_list[len++] = ',';
+    do {
+        digits[count++] = '0' + channel % 10;
+        channel /= 10;
+    } while (channel > 0);
+
+    while (count > 0) channel_list[len++] = digits[--count];
+    return len;
+}
 
-    while (SCPI_ExprChannelListEntry(context, &param, index++, &is_range, &from_ch, &to_ch, 1, &dimensions) == SCPI_EXPR_OK)
+// Parse time parameter in seconds (or with unit) into milliseconds.
+// Accepts MIN, MAX and DEF.
+static scpi_bool_t param_milliseconds(scpi_t *context, uint32_t *result, uint32_t def_ms, uint32_t max_ms)
+{
+    scpi_number_t value;
+
+    if (!SCPI_ParamNumber(context, scpi_special_numbers_def, &value, TRUE))
+        return FALSE;
+
+    if (value.special)
     {
-        if (from_ch < 1 || from_ch > RELAY_COUNT) return SCPI_RES_ERR;
-        
-        if (!is_range)
-        {
-            channel_mask |= (1 << (from_ch - 1));
-        }
+        if (value.content.tag == SCPI_NUM_MIN)
+            *result = 0;
+        else if (value.content.tag == SCPI_NUM_MAX)
+            *result = max_ms;
+        else if (value.content.tag == SCPI_NUM_DEF)
+            *result = def_ms;
         else
+            return FALSE;
+    }
+    else
+    {
+        if ((value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_SECOND) ||
+            value.content.value < 0 || value.content.value * 1000 > max_ms)
         {
-            if (to_ch < 1 || to_ch > RELAY_COUNT) return SCPI_RES_ERR;
-
-            for (int i = from_ch; i <= to_ch; i++)
-            {
-                channel_mask |= (1 << (i - 1));
-            }
+            SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+            return FALSE;
         }
+
+        *result = value.content.value * 1000 + 0.5;
     }
 
+    return TRUE;
+}
+
+// Close or open switches based on SCPI standard channel list.
+// Examples:
+//   ROUTE:CLOSE (@1,2)
+//   ROUTE:OPEN (@1:4)
+//   ROUTE:CLOSE? (@1)
+scpi_result_t SCPI_ROUTe_OpenClose(scpi_t *context)
+{
+    relay_mask_t channel_mask;
+
+    if (!param_channel_mask(context, &channel_mask, TRUE))
+        return SCPI_RES_ERR;
+
     if (SCPI_CmdTag(context) == 0)
     {
-        open_relays(channel_mask);
+        route_apply(route_state() & ~channel_mask, false);
     }
     else if (SCPI_CmdTag(context) == 1)
     {
-        close_relays(channel_mask);
+        if (!mux_state_valid(route_state() | channel_mask))
+        {
+            SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+            return SCPI_RES_ERR;
+        }
+
+        route_apply(route_state() | channel_mask, false);
     }
     else if (SCPI_CmdTag(context) == 2)
     {
         // Report status for each queried channel
-        uint32_t state = relays_get_state();
+        relay_mask_t state = route_state();
         uint8_t result[RELAY_COUNT] = {0};
         int result_len = 0;
         for (int i = 0; i < RELAY_COUNT; i++)
         {
-            if (channel_mask & (1 << i))
+            if (channel_mask & RELAY_BIT(i))
             {
-                result[result_len++] = !!(state & (1 << i));
+                result[result_len++] = !!(state & RELAY_BIT(i));
             }
         }
 
@@ -66,91 +181,1177 @@ scpi_result_t SCPI_ROUTe_OpenClose(scpi_t *context)
 
 scpi_result_t SCPI_ROUTe_OPENALL(scpi_t *context)
 {
-    open_relays(~0);
+    route_apply(0, false);
     return SCPI_RES_OK;
 }
 
-// Query list of all closed switches
-scpi_result_t SCPI_ROUTe_STATEQ(scpi_t *context)
+// Return channels of a mask as a "(@1,2,...)" list
+static void result_channel_list(scpi_t *context, relay_mask_t state)
 {
-    uint32_t state = relays_get_state();
-    char channel_list[3 + RELAY_COUNT * 2];
+    char channel_list[3 + RELAY_COUNT * 4];
     channel_list[0] = '(';
     channel_list[1] = '@';
     int len = 2;
     
     for (int i = 0; i < RELAY_COUNT; i++)
     {
-        if (state & (1 << i))
+        if (state & RELAY_BIT(i))
         {
-            if (len > 2) channel_list[len++] = ',';
-            channel_list[len++] = '0' + (i + 1);
+            len = append_channel(channel_list, len, i + 1);
         }
     }
 
     channel_list[len++] = ')';
 
     SCPI_ResultArbitraryBlock(context, channel_list, len);
+}
+
+// Query list of all closed switches
+scpi_result_t SCPI_ROUTe_STATEQ(scpi_t *context)
+{
+    result_channel_list(context, route_state());
     return SCPI_RES_OK;
 }
 
 // Set state of relays from a numeric value
 scpi_result_t SCPI_ROUTe_SET(scpi_t *context)
 {
-    uint32_t state = relays_get_state();
-    uint32_t target;
+    relay_mask_t target;
+
+    if (!param_relay_mask(context, &target, true))
+        return SCPI_RES_ERR;
 
-    if (!SCPI_ParamUInt32(context, &target, true))
+    if (!mux_state_valid(target))
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
         return SCPI_RES_ERR;
+    }
     
-    if (SCPI_CmdTag(context) == 0)
+    // Tag 0: break before make, tag 1: make before break
+    route_apply(target, SCPI_CmdTag(context) == 1);
+
+    return SCPI_RES_OK;
+}
+
+// Start collecting relay commands into one transition.
+// Example:
+//   ROUTE:BEGIN;OPEN (@1);CLOSE (@2);OPEN (@5);CLOSE (@6);COMMIT
+scpi_result_t SCPI_ROUTe_BEGin(scpi_t *context)
+{
+    if (!g_route_transaction)
+    {
+        g_route_pending = relays_get_state();
+        g_route_transaction = true;
+    }
+    return SCPI_RES_OK;
+}
+
+// Apply collected relay commands in one break-before-make (tag 0)
+// or make-before-break (tag 1) transition
+scpi_result_t SCPI_ROUTe_COMMit(scpi_t *context)
+{
+    if (!g_route_transaction)
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+
+    // Exclusive mode may have been enabled after the commands were checked
+    if (!mux_state_valid(g_route_pending))
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+        return SCPI_RES_ERR;
+    }
+
+    g_route_transaction = false;
+    relays_set_state(g_route_pending, SCPI_CmdTag(context) == 1);
+    return SCPI_RES_OK;
+}
+
+// Discard collected relay commands
+scpi_result_t SCPI_ROUTe_DISCard(scpi_t *context)
+{
+    g_route_transaction = false;
+    return SCPI_RES_OK;
+}
+
+// Query whether a transaction is open
+scpi_result_t SCPI_ROUTe_BEGinQ(scpi_t *context)
+{
+    SCPI_ResultBool(context, g_route_transaction);
+    return SCPI_RES_OK;
+}
+
+static const scpi_choice_def_t g_route_storage[] = {
+    {"RAM",   0},
+    {"FLASh", 1},
+    SCPI_CHOICE_LIST_END
+};
+
+// Name a channel list, so that the name can be used in place of the list.
+// FLASh keeps the route over power cycles, RAM (default) until power-off.
+// Example:
+//   ROUTE:DEFINE DMMA,(@1,6),FLASH
+//   CLOSE DMMA
+scpi_result_t SCPI_ROUTe_DEFine(scpi_t *context)
+{
+    const char *name;
+    size_t name_len;
+    relay_mask_t channel_mask;
+    int32_t storage = 0;
+
+    if (!SCPI_ParamCharacters(context, &name, &name_len, TRUE))
+        return SCPI_RES_ERR;
+
+    if (!param_channel_mask(context, &channel_mask, TRUE))
+        return SCPI_RES_ERR;
+
+    if (!SCPI_ParamChoice(context, g_route_storage, &storage, FALSE) &&
+        SCPI_ParamErrorOccurred(context))
+        return SCPI_RES_ERR;
+
+    int slot = routes_define(name, name_len, channel_mask, storage);
+    if (slot < 0)
+    {
+        // Invalid name or all routes in use
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+
+    presets_save_route(slot);
+    return SCPI_RES_OK;
+}
+
+// Query channels of a route
+scpi_result_t SCPI_ROUTe_DEFineQ(scpi_t *context)
+{
+    scpi_parameter_t param;
+    relay_mask_t channel_mask;
+
+    if (!SCPI_Parameter(context, &param, TRUE))
+        return SCPI_RES_ERR;
+
+    if (!param_route_mask(context, &param, &channel_mask))
+        return SCPI_RES_ERR;
+
+    result_channel_list(context, channel_mask);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_ROUTe_DELete(scpi_t *context)
+{
+    const char *name;
+    size_t name_len;
+
+    if (!SCPI_ParamCharacters(context, &name, &name_len, TRUE))
+        return SCPI_RES_ERR;
+
+    int slot = routes_delete(name, name_len);
+    if (slot < 0)
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+
+    presets_save_route(slot);
+    return SCPI_RES_OK;
+}
+
+// Query names of all defined routes, "" if there are none
+scpi_result_t SCPI_ROUTe_CATalogQ(scpi_t *context)
+{
+    bool found = false;
+    for (uint32_t slot = 0; slot < ROUTE_MAX; slot++)
+    {
+        const route_t *route = routes_get(slot);
+        if (route)
+        {
+            SCPI_ResultCharacters(context, route->name, routes_name_len(route));
+            found = true;
+        }
+    }
+
+    // A query without result would not be answered at all
+    if (!found)
+        SCPI_ResultText(context, "");
+
+    return SCPI_RES_OK;
+}
+
+// Parse preset slot number, pushes error if out of range
+static scpi_bool_t param_preset_slot(scpi_t *context, uint32_t *slot)
+{
+    if (!SCPI_ParamUInt32(context, slot, TRUE))
+        return FALSE;
+
+    if (*slot >= PRESET_COUNT)
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Save relay state in a preset slot, slot 0 is also the power-on state.
+// Example:
+//   *SAV 3
+scpi_result_t SCPI_RelaySav(scpi_t *context)
+{
+    uint32_t slot;
+
+    if (!param_preset_slot(context, &slot))
+        return SCPI_RES_ERR;
+
+    presets_save(slot, route_state());
+    return SCPI_RES_OK;
+}
+
+// Recall preset slot in a single break-before-make transition
+scpi_result_t SCPI_RelayRcl(scpi_t *context)
+{
+    uint32_t slot;
+    relay_mask_t state;
+
+    if (!param_preset_slot(context, &slot))
+        return SCPI_RES_ERR;
+
+    if (!presets_load(slot, &state))
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_EXECUTION_ERROR);
+        return SCPI_RES_ERR;
+    }
+
+    // Slot may have been saved before exclusive mode was enabled
+    if (!mux_state_valid(state))
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+        return SCPI_RES_ERR;
+    }
+
+    route_apply(state, false);
+    return SCPI_RES_OK;
+}
+
+// Query whether a preset slot has been saved
+scpi_result_t SCPI_MEMory_STATe_VALidQ(scpi_t *context)
+{
+    uint32_t slot;
+    relay_mask_t state;
+
+    if (!param_preset_slot(context, &slot))
+        return SCPI_RES_ERR;
+
+    SCPI_ResultBool(context, presets_load(slot, &state));
+    return SCPI_RES_OK;
+}
+
+// Recall slot 0 at power-on
+scpi_result_t SCPI_MEMory_STATe_RECall_AUTO(scpi_t *context)
+{
+    scpi_bool_t enable;
+
+    if (!SCPI_ParamBool(context, &enable, TRUE))
+        return SCPI_RES_ERR;
+
+    presets_set_power_on(enable);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_MEMory_STATe_RECall_AUTOQ(scpi_t *context)
+{
+    SCPI_ResultBool(context, presets_get_power_on());
+    return SCPI_RES_OK;
+}
+
+// Set operate (tag 0) or release (tag 1) time of channels, all channels if list is omitted.
+// Example:
+//   ROUTE:TIMING:OPERATE 5 ms,(@1:4)
+scpi_result_t SCPI_ROUTe_TIMing(scpi_t *context)
+{
+    relay_delay_t type = SCPI_CmdTag(context);
+    uint32_t delay_ms;
+    relay_mask_t channel_mask;
+
+    if (!param_milliseconds(context, &delay_ms,
+            type == RELAY_OPERATE ? RELAY_OPERATE_DELAY_MS : RELAY_RELEASE_DELAY_MS,
+            RELAY_MAX_DELAY_MS))
+        return SCPI_RES_ERR;
+
+    if (!param_channel_mask(context, &channel_mask, FALSE))
+    {
+        if (SCPI_ParamErrorOccurred(context))
+            return SCPI_RES_ERR;
+
+        channel_mask = RELAY_MASK;
+    }
+
+    relays_set_delay(channel_mask, type, delay_ms);
+    return SCPI_RES_OK;
+}
+
+// Query operate or release time of each listed channel, in seconds
+scpi_result_t SCPI_ROUTe_TIMingQ(scpi_t *context)
+{
+    relay_delay_t type = SCPI_CmdTag(context);
+    relay_mask_t channel_mask;
+
+    if (!param_channel_mask(context, &channel_mask, FALSE))
+    {
+        if (SCPI_ParamErrorOccurred(context))
+            return SCPI_RES_ERR;
+
+        channel_mask = RELAY_MASK;
+    }
+
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if (channel_mask & RELAY_BIT(i))
+        {
+            SCPI_ResultDouble(context, relays_get_delay(i, type) / 1000.0);
+        }
+    }
+
+    return SCPI_RES_OK;
+}
+
+// Set PWM duty in percent used to hold closed relays after their operate time.
+// 100 drives coils at full voltage, i.e. disables the economizer.
+// Example:
+//   COIL:HOLD 40
+scpi_result_t SCPI_ROUTe_COIL_HOLD(scpi_t *context)
+{
+    scpi_number_t value;
+    uint32_t percent;
+
+    if (!SCPI_ParamNumber(context, scpi_special_numbers_def, &value, TRUE))
+        return SCPI_RES_ERR;
+
+    if (value.special)
     {
-        // Break before make
-        open_relays(state & ~target);
-        close_relays(target);
+        if (value.content.tag == SCPI_NUM_MIN)
+            percent = RELAY_HOLD_DUTY_MIN;
+        else if (value.content.tag == SCPI_NUM_MAX)
+            percent = 100;
+        else if (value.content.tag == SCPI_NUM_DEF)
+            percent = RELAY_HOLD_DUTY_DEFAULT;
+        else
+            return SCPI_RES_ERR;
     }
     else
     {
-        // Make before break
-        close_relays(target);
-        open_relays(state & ~target);
+        // Below the minimum, relays could drop out under vibration
+        if (value.unit != SCPI_UNIT_NONE ||
+            value.content.value < RELAY_HOLD_DUTY_MIN || value.content.value > 100)
+        {
+            SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+            return SCPI_RES_ERR;
+        }
+
+        percent = value.content.value + 0.5;
     }
 
+    relays_set_hold_duty(percent);
     return SCPI_RES_OK;
 }
 
-scpi_result_t SCPI_ROUTe_GETQ(scpi_t *context)
+scpi_result_t SCPI_ROUTe_COIL_HOLDQ(scpi_t *context)
 {
-    uint32_t state = relays_get_state();
-    SCPI_ResultUInt32(context, state);
+    SCPI_ResultUInt32(context, relays_get_hold_duty());
     return SCPI_RES_OK;
 }
 
-const scpi_command_t g_scpi_commands[] = {
-    /* IEEE Mandated Commands (SCPI std V1999.0 4.1.1) */
-    { .pattern = "*CLS", .callback = SCPI_CoreCls,},
-    { .pattern = "*ESE", .callback = SCPI_CoreEse,},
-    { .pattern = "*ESE?", .callback = SCPI_CoreEseQ,},
-    { .pattern = "*ESR?", .callback = SCPI_CoreEsrQ,},
-    { .pattern = "*IDN?", .callback = SCPI_CoreIdnQ,},
-    { .pattern = "*OPC", .callback = SCPI_CoreOpc,},
-    { .pattern = "*OPC?", .callback = SCPI_CoreOpcQ,},
-    { .pattern = "*RST", .callback = SCPI_CoreRst,},
-    { .pattern = "*SRE", .callback = SCPI_CoreSre,},
-    { .pattern = "*SRE?", .callback = SCPI_CoreSreQ,},
-    { .pattern = "*STB?", .callback = SCPI_CoreStbQ,},
-    { .pattern = "*TST?", .callback = SCPI_CoreTstQ,},
-    { .pattern = "*WAI", .callback = SCPI_CoreWai,},
-    
-    {"[ROUTe]:OPEN",            SCPI_ROUTe_OpenClose,   0},
-    {"[ROUTe]:CLOSe",           SCPI_ROUTe_OpenClose,   1},
-    {"[ROUTe]:CLOSe?",          SCPI_ROUTe_OpenClose,   2},
-    {"[ROUTe]:OPEN:ALL",        SCPI_ROUTe_OPENALL,     0},
-    {"[ROUTe]:CLOSe:STATe?",    SCPI_ROUTe_STATEQ,      0},
+// Query average coil current of each listed channel in amperes, all channels if list is omitted
+scpi_result_t SCPI_ROUTe_COIL_CURRentQ(scpi_t *context)
+{
+    relay_mask_t channel_mask;
+
+    if (!param_channel_mask(context, &channel_mask, FALSE))
+    {
+        if (SCPI_ParamErrorOccurred(context))
+            return SCPI_RES_ERR;
+
+        channel_mask = RELAY_MASK;
+    }
+
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if (channel_mask & RELAY_BIT(i))
+        {
+            SCPI_ResultDouble(context, relays_get_coil_current(i) / 1e6);
+        }
+    }
+
+    return SCPI_RES_OK;
+}
+
+// Set total coil current allowed while relays operate, in amperes
+// Example:
+//   COIL:BUDGET 0.1
+scpi_result_t SCPI_ROUTe_COIL_BUDGet(scpi_t *context)
+{
+    scpi_number_t value;
+    uint32_t budget_ua;
+
+    if (!SCPI_ParamNumber(context, scpi_special_numbers_def, &value, TRUE))
+        return SCPI_RES_ERR;
+
+    if (value.special)
+    {
+        if (value.content.tag == SCPI_NUM_MIN)
+            budget_ua = RELAY_COIL_INRUSH_UA;
+        else if (value.content.tag == SCPI_NUM_MAX)
+            budget_ua = RELAY_CURRENT_BUDGET_MAX_UA;
+        else if (value.content.tag == SCPI_NUM_DEF)
+            budget_ua = RELAY_CURRENT_BUDGET_DEFAULT_UA;
+        else
+            return SCPI_RES_ERR;
+    }
+    else
+    {
+        // Budget must fit at least one coil
+        if ((value.unit != SCPI_UNIT_NONE && value.unit != SCPI_UNIT_AMPER) ||
+            value.content.value * 1e6 < RELAY_COIL_INRUSH_UA ||
+            value.content.value * 1e6 > RELAY_CURRENT_BUDGET_MAX_UA)
+        {
+            SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+            return SCPI_RES_ERR;
+        }
+
+        budget_ua = value.content.value * 1e6 + 0.5;
+    }
+
+    relays_set_current_budget(budget_ua);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_ROUTe_COIL_BUDGetQ(scpi_t *context)
+{
+    SCPI_ResultDouble(context, relays_get_current_budget() / 1e6);
+    return SCPI_RES_OK;
+}
+
+// Predict time in seconds until relays would settle if SET was issued now.
+// Includes operations that are still queued.
+// MAX returns the worst case for any transition under the current budget.
+scpi_result_t SCPI_ROUTe_SET_TIMeQ(scpi_t *context)
+{
+    scpi_number_t value;
+
+    if (!SCPI_ParamNumber(context, scpi_special_numbers_def, &value, TRUE))
+        return SCPI_RES_ERR;
+
+    if (value.special)
+    {
+        if (value.content.tag != SCPI_NUM_MAX)
+        {
+            SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+            return SCPI_RES_ERR;
+        }
+
+        SCPI_ResultDouble(context, relays_worst_case() / 1000.0);
+    }
+    else
+    {
+        if (value.content.value < 0 || value.content.value > (double)(relay_mask_t)-1)
+        {
+            SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+            return SCPI_RES_ERR;
+        }
+
+        relay_mask_t target = value.content.value;
+        SCPI_ResultDouble(context, relays_predict(target & RELAY_MASK) / 1000.0);
+    }
+
+    return SCPI_RES_OK;
+}
+
+// Select one channel in each given mux group, in a single break-before-make transition.
+// Empty channel list opens all channels of the group.
+// Examples:
+//   ROUTE:MUX:SELECT 1,(@3)
+//   ROUTE:MUX:SELECT 1,(@2),2,(@7)
+scpi_result_t SCPI_ROUTe_MUX_SELect(scpi_t *context)
+{
+    relay_mask_t channels = 0;
+    uint32_t empty_groups = 0;
+    int32_t group;
+    scpi_bool_t first = TRUE;
+
+    while (SCPI_ParamInt32(context, &group, first))
+    {
+        relay_mask_t channel_mask;
+        first = FALSE;
+
+        if (group < 1 || group > MUX_GROUP_COUNT)
+        {
+            SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+            return SCPI_RES_ERR;
+        }
+
+        if (!param_channel_mask(context, &channel_mask, TRUE))
+            return SCPI_RES_ERR;
+
+        if ((channel_mask & ~mux_group_mask(group - 1)) ||
+            (channel_mask & (channel_mask - 1)))
+        {
+            SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+            return SCPI_RES_ERR;
+        }
+
+        if (channel_mask == 0)
+            empty_groups |= (1 << (group - 1));
+        channels |= channel_mask;
+    }
+
+    if (SCPI_ParamErrorOccurred(context))
+        return SCPI_RES_ERR;
+
+    route_apply(mux_select_state(route_state(), channels, empty_groups), false);
+    return SCPI_RES_OK;
+}
+
+// Query selected channel of a mux group, 0 if none
+scpi_result_t SCPI_ROUTe_MUX_SELectQ(scpi_t *context)
+{
+    int32_t group;
+
+    if (!SCPI_ParamInt32(context, &group, TRUE))
+        return SCPI_RES_ERR;
+
+    if (group < 1 || group > MUX_GROUP_COUNT)
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_ILLEGAL_PARAMETER_VALUE);
+        return SCPI_RES_ERR;
+    }
+
+    relay_mask_t state = route_state() & mux_group_mask(group - 1);
+    int32_t channel = 0;
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if (state & RELAY_BIT(i))
+        {
+            channel = i + 1;
+            break;
+        }
+    }
+
+    SCPI_ResultInt32(context, channel);
+    return SCPI_RES_OK;
+}
+
+// Enforce that at most one channel in each mux group is closed
+scpi_result_t SCPI_ROUTe_MUX_EXCLusive(scpi_t *context)
+{
+    scpi_bool_t enable;
+
+    if (!SCPI_ParamBool(context, &enable, TRUE))
+        return SCPI_RES_ERR;
+
+    if (!mux_set_exclusive(enable))
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+        return SCPI_RES_ERR;
+    }
+
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_ROUTe_MUX_EXCLusiveQ(scpi_t *context)
+{
+    SCPI_ResultBool(context, mux_get_exclusive());
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_ROUTe_GETQ(scpi_t *context)
+{
+    relay_mask_t state = route_state();
+    result_relay_mask(context, state);
+    return SCPI_RES_OK;
+}
+
+// Define scan list, each channel is closed in turn.
+// Example:
+//   ROUTE:SCAN (@1:4,5:8)
+scpi_result_t SCPI_ROUTe_SCAN(scpi_t *context)
+{
+    scpi_parameter_t param;
+    chanlist_iter_t iter;
+    chanlist_result_t res;
+    uint32_t from_ch, to_ch;
+    relay_mask_t steps[SCAN_MAX_STEPS];
+    uint32_t count = 0;
+
+    if (!SCPI_Parameter(context, &param, TRUE))
+        return SCPI_RES_ERR;
+
+    // A route has no order, its channels are scanned in ascending order
+    if (param_is_route(&param))
+    {
+        relay_mask_t channel_mask;
+        if (!param_route_mask(context, &param, &channel_mask))
+            return SCPI_RES_ERR;
+
+        for (int i = 0; i < RELAY_COUNT; i++)
+        {
+            if (!(channel_mask & RELAY_BIT(i)))
+                continue;
+
+            if (count >= SCAN_MAX_STEPS)
+            {
+                SCPI_ErrorPush(context, SCPI_ERROR_TOO_MUCH_DATA);
+                return SCPI_RES_ERR;
+            }
+
+            steps[count++] = RELAY_BIT(i);
+        }
+
+        res = CHANLIST_END;
+    }
+    else
+    {
+        // Order of entries matters here, so the list is walked instead of compiled to a mask
+        res = chanlist_begin(&iter, param.ptr, param.len);
+    }
+
+    while (res == CHANLIST_OK && (res = chanlist_next(&iter, &from_ch, &to_ch)) == CHANLIST_OK)
+    {
+        if (from_ch < 1 || from_ch > RELAY_COUNT || to_ch < 1 || to_ch > RELAY_COUNT)
+            res = CHANLIST_RANGE;
+        if (res != CHANLIST_OK)
+            break;
+
+        int dir = (to_ch >= from_ch) ? 1 : -1;
+        for (int i = from_ch; ; i += dir)
+        {
+            if (count >= SCAN_MAX_STEPS)
+            {
+                SCPI_ErrorPush(context, SCPI_ERROR_TOO_MUCH_DATA);
+                return SCPI_RES_ERR;
+            }
+
+            steps[count++] = RELAY_BIT(i - 1);
+            if (i == (int)to_ch) break;
+        }
+    }
+
+    if (!chanlist_check(context, res))
+        return SCPI_RES_ERR;
+
+    if (!scan_set_list(steps, count))
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+        return SCPI_RES_ERR;
+    }
+
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_ROUTe_SCANQ(scpi_t *context)
+{
+    const relay_mask_t *steps;
+    uint32_t count = scan_get_list(&steps);
+    char channel_list[3 + SCAN_MAX_STEPS * 4];
+    channel_list[0] = '(';
+    channel_list[1] = '@';
+    int len = 2;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        for (int j = 0; j < RELAY_COUNT; j++)
+        {
+            if (steps[i] & RELAY_BIT(j))
+            {
+                len = append_channel(channel_list, len, j + 1);
+            }
+        }
+    }
+
+    channel_list[len++] = ')';
+
+    SCPI_ResultArbitraryBlock(context, channel_list, len);
+    return SCPI_RES_OK;
+}
+
+// Time to stay on each channel after it has settled
+scpi_result_t SCPI_ROUTe_SCAN_DWELl(scpi_t *context)
+{
+    uint32_t dwell_ms;
+
+    if (!param_milliseconds(context, &dwell_ms, SCAN_DEFAULT_DWELL_MS, SCAN_MAX_DWELL_MS))
+        return SCPI_RES_ERR;
+
+    scan_set_dwell(dwell_ms);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_ROUTe_SCAN_DWELlQ(scpi_t *context)
+{
+    SCPI_ResultDouble(context, scan_get_dwell() / 1000.0);
+    return SCPI_RES_OK;
+}
+
+// Query scan state as: running, current step (1-based), completed passes
+scpi_result_t SCPI_ROUTe_SCAN_PROGressQ(scpi_t *context)
+{
+    uint32_t step, pass;
+    scan_get_progress(&step, &pass);
+    SCPI_ResultBool(context, scan_running());
+    SCPI_ResultUInt32(context, step + 1);
+    SCPI_ResultUInt32(context, pass);
+    return SCPI_RES_OK;
+}
+
+// Number of passes through scan list, INF for continuous scanning
+scpi_result_t SCPI_TRIGger_COUNt(scpi_t *context)
+{
+    scpi_number_t value;
+
+    if (!SCPI_ParamNumber(context, scpi_special_numbers_def, &value, TRUE))
+        return SCPI_RES_ERR;
+
+    if (value.special)
+    {
+        if (value.content.tag == SCPI_NUM_INF)
+            scan_set_count(0);
+        else if (value.content.tag == SCPI_NUM_MIN || value.content.tag == SCPI_NUM_DEF)
+            scan_set_count(1);
+        else
+            return SCPI_RES_ERR;
+    }
+    else
+    {
+        if (value.content.value < 1 || value.content.value > UINT32_MAX)
+        {
+            SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+            return SCPI_RES_ERR;
+        }
+
+        scan_set_count(value.content.value);
+    }
+
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_TRIGger_COUNtQ(scpi_t *context)
+{
+    uint32_t count = scan_get_count();
+    if (count == 0)
+        SCPI_ResultDouble(context, 9.9e37); // SCPI representation of INF
+    else
+        SCPI_ResultUInt32(context, count);
+    return SCPI_RES_OK;
+}
+
+static const scpi_choice_def_t g_trigger_sources[] = {
+    {"IMMediate", SCAN_TRIG_IMMEDIATE},
+    {"BUS",       SCAN_TRIG_BUS},
+    {"EXTernal",  SCAN_TRIG_EXTERNAL},
+    SCPI_CHOICE_LIST_END
+};
+
+// What advances the scan: IMMediate after dwell, BUS on *TRG, EXTernal on
+// rising edge of the CYCLE input, which then no longer works as a button.
+scpi_result_t SCPI_TRIGger_SOURce(scpi_t *context)
+{
+    int32_t source;
+
+    if (!SCPI_ParamChoice(context, g_trigger_sources, &source, TRUE))
+        return SCPI_RES_ERR;
+
+    scan_set_trigger_source(source);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_TRIGger_SOURceQ(scpi_t *context)
+{
+    const char *name;
+    SCPI_ChoiceToName(g_trigger_sources, scan_get_trigger_source(), &name);
+    SCPI_ResultMnemonic(context, name);
+    return SCPI_RES_OK;
+}
+
+// Delay from BUS or EXTernal trigger to switching, 1 ms resolution
+scpi_result_t SCPI_TRIGger_DELay(scpi_t *context)
+{
+    uint32_t delay_ms;
+
+    if (!param_milliseconds(context, &delay_ms, 0, SCAN_MAX_DWELL_MS))
+        return SCPI_RES_ERR;
+
+    scan_set_trigger_delay(delay_ms);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_TRIGger_DELayQ(scpi_t *context)
+{
+    SCPI_ResultDouble(context, scan_get_trigger_delay() / 1000.0);
+    return SCPI_RES_OK;
+}
+
+// Bus trigger, ignored unless the scan waits for one
+scpi_result_t SCPI_RelayTrg(scpi_t *context)
+{
+    if (scan_get_trigger_source() == SCAN_TRIG_BUS)
+        scan_trigger();
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_INITiate(scpi_t *context)
+{
+    if (!scan_running() && !scan_list_valid(relays_get_state()))
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_SETTINGS_CONFLICT);
+        return SCPI_RES_ERR;
+    }
+
+    if (!scan_start())
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_INIT_IGNORED);
+        return SCPI_RES_ERR;
+    }
+
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_ABORt(scpi_t *context)
+{
+    scan_abort();
+    return SCPI_RES_OK;
+}
+
+// Query number of operations of each listed channel, all channels if list is omitted.
+// Counts are saved to flash once per hour while they change, see presets.h.
+// Example:
+//   DIAGNOSTIC:RELAY:CYCLES? (@1:8)
+scpi_result_t SCPI_DIAGnostic_RELay_CYCLesQ(scpi_t *context)
+{
+    relay_mask_t channel_mask;
+
+    if (!param_channel_mask(context, &channel_mask, FALSE))
+    {
+        if (SCPI_ParamErrorOccurred(context))
+            return SCPI_RES_ERR;
+
+        channel_mask = RELAY_MASK;
+    }
+
+    for (int i = 0; i < RELAY_COUNT; i++)
+    {
+        if (channel_mask & RELAY_BIT(i))
+        {
+            SCPI_ResultUInt32(context, relays_get_cycles(i));
+        }
+    }
+
+    return SCPI_RES_OK;
+}
+
+static const scpi_choice_def_t g_perf_stages[] = {
+    {"RX",      PERF_RX},
+    {"PARSe",   PERF_PARSE},
+    {"ENQueue", PERF_ENQUEUE},
+    {"ACTuate", PERF_ACTUATE},
+    {"TX",      PERF_TX},
+    SCPI_CHOICE_LIST_END
+};
+
+// Latency statistics in microseconds.
+// Without parameter: name,count,min,mean,max for each stage.
+// With stage name: count,min,mean,max followed by log2 histogram bins.
+scpi_result_t SCPI_SYSTem_PERFormanceQ(scpi_t *context)
+{
+    int32_t stage;
+    perf_stats_t stats;
+
+    if (SCPI_ParamChoice(context, g_perf_stages, &stage, FALSE))
+    {
+        perf_get(stage, &stats);
+        SCPI_ResultUInt32(context, stats.count);
+        SCPI_ResultUInt32(context, stats.count ? stats.min : 0);
+        SCPI_ResultUInt32(context, stats.count ? (uint32_t)(stats.sum / stats.count) : 0);
+        SCPI_ResultUInt32(context, stats.max);
+        SCPI_ResultArrayUInt16(context, stats.hist, PERF_HIST_BINS, SCPI_FORMAT_ASCII);
+        return SCPI_RES_OK;
+    }
+
+    if (SCPI_ParamErrorOccurred(context))
+        return SCPI_RES_ERR;
+
+    for (int i = 0; i < PERF_STAGE_COUNT; i++)
+    {
+        const char *name;
+        perf_get(i, &stats);
+        SCPI_ChoiceToName(g_perf_stages, i, &name);
+        SCPI_ResultMnemonic(context, name);
+        SCPI_ResultUInt32(context, stats.count);
+        SCPI_ResultUInt32(context, stats.count ? stats.min : 0);
+        SCPI_ResultUInt32(context, stats.count ? (uint32_t)(stats.sum / stats.count) : 0);
+        SCPI_ResultUInt32(context, stats.max);
+    }
+
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_SYSTem_PERFormance_RESet(scpi_t *context)
+{
+    perf_reset();
+    return SCPI_RES_OK;
+}
+
+// Relay commands are overlapped: they return as soon as the operation is queued.
+// *OPC, *OPC? and *WAI complete only after all queued relay operations have settled
+// and a finite scan has finished. Continuous scans never complete, so they are not waited for.
+static bool g_opc_pending;
+
+// A scan that waits for a BUS or EXTernal trigger is not pending: the
+// trigger may only come after *OPC? has returned, e.g. *TRG on this port.
+static bool operation_pending()
+{
+    return relays_busy() ||
+           (scan_running() && scan_get_count() != 0 && !scan_waiting_trigger());
+}
+
+static void operation_wait()
+{
+    while (operation_pending())
+    {
+        __WFI();
+    }
+}
+
+scpi_result_t SCPI_RelayOpc(scpi_t *context)
+{
+    g_opc_pending = true;
+    scpi_commands_poll(context);
+    return SCPI_RES_OK;
+}
+
+// A pending *OPC is cleared as well, so its bit is not set after *CLS
+scpi_result_t SCPI_RelayCls(scpi_t *context)
+{
+    g_opc_pending = false;
+    return SCPI_CoreCls(context);
+}
+
+scpi_result_t SCPI_RelayOpcQ(scpi_t *context)
+{
+    operation_wait();
+    SCPI_ResultInt32(context, 1);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_RelayWai(scpi_t *context)
+{
+    operation_wait();
+    return SCPI_RES_OK;
+}
+
+// Bring relays to a defined state: stop the scan, drop an open transaction
+// and open all channels. Settings such as timing and scan list are kept.
+scpi_result_t SCPI_RelayRst(scpi_t *context)
+{
+    scan_abort();
+    g_route_transaction = false;
+    g_route_pending = 0;
+    open_relays(RELAY_MASK);
+    return SCPI_CoreRst(context);
+}
+
+// STATus:OPERation register. Condition transitions selected by the
+// PTRansition and NTRansition filters are latched into the event register,
+// which is summarized in bit 7 of *STB? and can request service via *SRE.
+static uint16_t g_oper_condition;
+static uint16_t g_oper_ptr = 0x7FFF;
+static uint16_t g_oper_ntr;
+static uint32_t g_oper_stalls;
+
+static uint16_t operation_condition()
+{
+    uint16_t cond = 0;
+    if (relays_busy()) cond |= OPER_SETTLING;
+    if (scan_running()) cond |= OPER_SCANNING;
+    if (scan_waiting_trigger()) cond |= OPER_WAIT_TRIGGER;
+    return cond;
+}
+
+void scpi_commands_poll(scpi_t *context)
+{
+    if (g_opc_pending && !operation_pending())
+    {
+        g_opc_pending = false;
+        SCPI_RegSetBits(context, SCPI_REG_ESR, ESR_OPC);
+    }
+
+    uint16_t cond = operation_condition();
+    uint16_t events = (cond & ~g_oper_condition & g_oper_ptr) |
+                      (~cond & g_oper_condition & g_oper_ntr);
+    g_oper_condition = cond;
+
+    // Overflow has no lasting condition, it is reported as an event only
+    uint32_t stalls = relays_queue_stalls();
+    if (stalls != g_oper_stalls)
+    {
+        g_oper_stalls = stalls;
+        events |= OPER_QUEUE_FULL;
+    }
+
+    if (events)
+        SCPI_RegSetBits(context, SCPI_REG_OPER, events);
+}
+
+// Query and clear operation event register
+scpi_result_t SCPI_STATus_OPERation_EVENtQ(scpi_t *context)
+{
+    SCPI_ResultInt32(context, SCPI_RegGet(context, SCPI_REG_OPER));
+    SCPI_RegSet(context, SCPI_REG_OPER, 0);
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_STATus_OPERation_CONDitionQ(scpi_t *context)
+{
+    SCPI_ResultInt32(context, operation_condition());
+    return SCPI_RES_OK;
+}
+
+// Set enable (tag 0), positive transition (tag 1) or negative transition (tag 2) mask
+// Example, request service when relays have settled:
+//   STATUS:OPERATION:NTRANSITION 2;ENABLE 2;*SRE 128
+scpi_result_t SCPI_STATus_OPERation_Mask(scpi_t *context)
+{
+    uint32_t mask;
+
+    if (!SCPI_ParamUInt32(context, &mask, TRUE))
+        return SCPI_RES_ERR;
+
+    if (mask > 0x7FFF)
+    {
+        SCPI_ErrorPush(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+        return SCPI_RES_ERR;
+    }
+
+    if (SCPI_CmdTag(context) == 0)
+        SCPI_RegSet(context, SCPI_REG_OPERE, mask);
+    else if (SCPI_CmdTag(context) == 1)
+        g_oper_ptr = mask;
+    else
+        g_oper_ntr = mask;
+
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_STATus_OPERation_MaskQ(scpi_t *context)
+{
+    if (SCPI_CmdTag(context) == 0)
+        SCPI_ResultInt32(context, SCPI_RegGet(context, SCPI_REG_OPERE));
+    else if (SCPI_CmdTag(context) == 1)
+        SCPI_ResultInt32(context, g_oper_ptr);
+    else
+        SCPI_ResultInt32(context, g_oper_ntr);
+
+    return SCPI_RES_OK;
+}
+
+scpi_result_t SCPI_STATus_PRESet(scpi_t *context)
+{
+    g_oper_ptr = 0x7FFF;
+    g_oper_ntr = 0;
+    SCPI_RegSet(context, SCPI_REG_OPERE, 0);
+    SCPI_RegSet(context, SCPI_REG_QUESE, 0);
+    return SCPI_RES_OK;
+}
+
+// Headers are looked up through an index that scripts/gen_scpi_index.py
+// generates from this table at build time, see scpi_dispatch.h. Patterns
+// must be string literals, and the build fails if a header matches two of
+// them. Lines the index does not cover, e.g. with an undefined header, are
+// still searched linearly by scpi-parser, so commands issued in tight test
+// loops stay first, together with *STB? and *OPC? that the host library
+// appends to every line, and setup and diagnostics commands last.
+const scpi_command_t g_scpi_commands[] = {
+    /* Relay switching */
+    {"[ROUTe]:CLOSe",           SCPI_ROUTe_OpenClose,   1},
+    {"[ROUTe]:OPEN",            SCPI_ROUTe_OpenClose,   0},
     {"[ROUTe]:SET[:BBM]",       SCPI_ROUTe_SET,         0},
+    {"[ROUTe]:MUX[:SELect]",    SCPI_ROUTe_MUX_SELect,  0},
     {"[ROUTe]:SET:MBB",         SCPI_ROUTe_SET,         1},
+    {"[ROUTe]:OPEN:ALL",        SCPI_ROUTe_OPENALL,     0},
+    { .pattern = "*OPC?", .callback = SCPI_RelayOpcQ,},
+    { .pattern = "*WAI", .callback = SCPI_RelayWai,},
+    { .pattern = "*STB?", .callback = SCPI_CoreStbQ,},
     {"[ROUTe]:GET?",            SCPI_ROUTe_GETQ,        0},
-    
+    {"[ROUTe]:CLOSe?",          SCPI_ROUTe_OpenClose,   2},
+    {"[ROUTe]:CLOSe:STATe?",    SCPI_ROUTe_STATEQ,      0},
+    {"[ROUTe]:MUX[:SELect]?",   SCPI_ROUTe_MUX_SELectQ, 0},
+    {"[ROUTe]:BEGin",           SCPI_ROUTe_BEGin,       0},
+    {"[ROUTe]:COMMit[:BBM]",    SCPI_ROUTe_COMMit,      0},
+    {"[ROUTe]:COMMit:MBB",      SCPI_ROUTe_COMMit,      1},
+    {"[ROUTe]:DISCard",         SCPI_ROUTe_DISCard,     0},
+    {"[ROUTe]:BEGin?",          SCPI_ROUTe_BEGinQ,      0},
+
+    /* Scanning */
+    {"INITiate[:IMMediate]",    SCPI_INITiate,          0},
+    {"ABORt",                   SCPI_ABORt,             0},
+    {"[ROUTe]:SCAN:PROGress?",  SCPI_ROUTe_SCAN_PROGressQ, 0},
+    {"[ROUTe]:SCAN",            SCPI_ROUTe_SCAN,        0},
+    {"[ROUTe]:SCAN?",           SCPI_ROUTe_SCANQ,       0},
+    {"[ROUTe]:SCAN:DWELl",      SCPI_ROUTe_SCAN_DWELl,  0},
+    {"[ROUTe]:SCAN:DWELl?",     SCPI_ROUTe_SCAN_DWELlQ, 0},
+    {"TRIGger:COUNt",           SCPI_TRIGger_COUNt,     0},
+    {"TRIGger:COUNt?",          SCPI_TRIGger_COUNtQ,    0},
+    {"TRIGger:SOURce",          SCPI_TRIGger_SOURce,    0},
+    {"TRIGger:SOURce?",         SCPI_TRIGger_SOURceQ,   0},
+    {"TRIGger:DELay",           SCPI_TRIGger_DELay,     0},
+    {"TRIGger:DELay?",          SCPI_TRIGger_DELayQ,    0},
+
+    /* IEEE Mandated Commands (SCPI std V1999.0 4.1.1) */
+    { .pattern = "*CLS", .callback = SCPI_RelayCls,},
+    { .pattern = "*ESE", .callback = SCPI_CoreEse,},
+    { .pattern = "*ESE?", .callback = SCPI_CoreEseQ,},
+    { .pattern = "*ESR?", .callback = SCPI_CoreEsrQ,},
+    { .pattern = "*IDN?", .callback = SCPI_CoreIdnQ,},
+    { .pattern = "*OPC", .callback = SCPI_RelayOpc,},
+    { .pattern = "*RST", .callback = SCPI_RelayRst,},
+    { .pattern = "*SRE", .callback = SCPI_CoreSre,},
+    { .pattern = "*SRE?", .callback = SCPI_CoreSreQ,},
+    { .pattern = "*TST?", .callback = SCPI_CoreTstQ,},
+    { .pattern = "*TRG", .callback = SCPI_RelayTrg,},
+    { .pattern = "*SAV", .callback = SCPI_RelaySav,},
+    { .pattern = "*RCL", .callback = SCPI_RelayRcl,},
+
+    /* Configuration */
+    {"[ROUTe]:SET:TIMe?",       SCPI_ROUTe_SET_TIMeQ,   0},
+    {"[ROUTe]:MUX:EXCLusive",   SCPI_ROUTe_MUX_EXCLusive, 0},
+    {"[ROUTe]:MUX:EXCLusive?",  SCPI_ROUTe_MUX_EXCLusiveQ, 0},
+    {"[ROUTe]:TIMing:OPERate",  SCPI_ROUTe_TIMing,      RELAY_OPERATE},
+    {"[ROUTe]:TIMing:OPERate?", SCPI_ROUTe_TIMingQ,     RELAY_OPERATE},
+    {"[ROUTe]:TIMing:RELease",  SCPI_ROUTe_TIMing,      RELAY_RELEASE},
+    {"[ROUTe]:TIMing:RELease?", SCPI_ROUTe_TIMingQ,     RELAY_RELEASE},
+    {"[ROUTe]:COIL:HOLD",       SCPI_ROUTe_COIL_HOLD,   0},
+    {"[ROUTe]:COIL:HOLD?",      SCPI_ROUTe_COIL_HOLDQ,  0},
+    {"[ROUTe]:COIL:CURRent?",   SCPI_ROUTe_COIL_CURRentQ, 0},
+    {"[ROUTe]:COIL:BUDGet",     SCPI_ROUTe_COIL_BUDGet, 0},
+    {"[ROUTe]:COIL:BUDGet?",    SCPI_ROUTe_COIL_BUDGetQ, 0},
+    {"[ROUTe]:DEFine",          SCPI_ROUTe_DEFine,      0},
+    {"[ROUTe]:DEFine?",         SCPI_ROUTe_DEFineQ,     0},
+    {"[ROUTe]:DELete",          SCPI_ROUTe_DELete,      0},
+    {"[ROUTe]:CATalog?",        SCPI_ROUTe_CATalogQ,    0},
+    {"MEMory:STATe:VALid?",     SCPI_MEMory_STATe_VALidQ, 0},
+    {"MEMory:STATe:RECall:AUTO", SCPI_MEMory_STATe_RECall_AUTO, 0},
+    {"MEMory:STATe:RECall:AUTO?", SCPI_MEMory_STATe_RECall_AUTOQ, 0},
+    {"STATus:OPERation[:EVENt]?", SCPI_STATus_OPERation_EVENtQ, 0},
+    {"STATus:OPERation:CONDition?", SCPI_STATus_OPERation_CONDitionQ, 0},
+    {"STATus:OPERation:ENABle", SCPI_STATus_OPERation_Mask, 0},
+    {"STATus:OPERation:ENABle?", SCPI_STATus_OPERation_MaskQ, 0},
+    {"STATus:OPERation:PTRansition", SCPI_STATus_OPERation_Mask, 1},
+    {"STATus:OPERation:PTRansition?", SCPI_STATus_OPERation_MaskQ, 1},
+    {"STATus:OPERation:NTRansition", SCPI_STATus_OPERation_Mask, 2},
+    {"STATus:OPERation:NTRansition?", SCPI_STATus_OPERation_MaskQ, 2},
+    {"STATus:PRESet",           SCPI_STATus_PRESet,     0},
+    {"SYSTem:PERFormance?",     SCPI_SYSTem_PERFormanceQ, 0},
+    {"SYSTem:PERFormance:RESet", SCPI_SYSTem_PERFormance_RESet, 0},
+    {"DIAGnostic:RELay:CYCLes?", SCPI_DIAGnostic_RELay_CYCLesQ, 0},
+
     SCPI_CMD_LIST_END
 };
 
@@ -6,8 +6,22 @@
 
 extern const scpi_command_t g_scpi_commands[];
 
+// Handle completion of overlapped commands and update STATus:OPERation,
+// called from main loop
+void scpi_commands_poll(scpi_t *context);
+
+// True between ROUTe:BEGin and ROUTe:COMMit or DISCard. Relay changes from
+// other sources are rejected meanwhile, so COMMit does not undo them.
+bool scpi_route_transaction_open(void);
+
+// STATus:OPERation bits
+#define OPER_SETTLING     (1 << 1)  // Relay operations queued or settling
+#define OPER_SCANNING     (1 << 3)  // Scan running (SCPI "sweeping")
+#define OPER_WAIT_TRIGGER (1 << 5)  // Scan waits for BUS or EXTernal trigger
+#define OPER_QUEUE_FULL   (1 << 8)  // Relay command waited for queue space
+
 #define SCPI_INPUT_BUFFER_LENGTH 128
-#define SCPI_OUTPUT_BUFFER_LENGTH 128
+#define SCPI_OUTPUT_BUFFER_LENGTH 256
 #define SCPI_ERROR_QUEUE_SIZE 17
 #define SCPI_IDN1 "devEmbedded"
 #define SCPI_IDN2 "RelayMux"
@@ -0,0 +1,346 @@
+#include "scpi_dispatch.h"
+#include "scpi_commands.h"
+#include <stdbool.h>
+#include <string.h>
+
+// Node of the header trie. Children are sorted by their short form.
+typedef struct {
+    uint16_t name;          // Mnemonic in g_scpi_index_names, in upper case
+    uint8_t short_len;
+    uint8_t long_len;
+    uint8_t children;       // First child in g_scpi_index_children
+    uint8_t child_count;
+    int8_t command;         // Index in g_scpi_commands, or -1
+    int8_t query;           // Same for the header followed by '?'
+} scpi_index_node_t;
+
+#include "scpi_index.h"
+
+/******************************************
+ * Header lookup                          *
+ ******************************************/
+
+static inline char to_upper(char c)
+{
+    return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+// Compare a mnemonic to the short form of a node, as if cut to its length
+static int compare_short(const char *mnemonic, size_t len, const scpi_index_node_t *node)
+{
+    const char *name = &g_scpi_index_names[node->name];
+    for (size_t i = 0; i < node->short_len; i++)
+    {
+        if (i == len)
+            return -1;
+
+        int diff = to_upper(mnemonic[i]) - name[i];
+        if (diff != 0)
+            return diff;
+    }
+    return 0;
+}
+
+// Rest of the long form, after the short form has matched
+static bool match_long(const char *mnemonic, size_t len, const scpi_index_node_t *node)
+{
+    if (len == node->short_len)
+        return true;
+    if (len != node->long_len)
+        return false;
+
+    const char *name = &g_scpi_index_names[node->name];
+    for (size_t i = node->short_len; i < len; i++)
+    {
+        if (to_upper(mnemonic[i]) != name[i])
+            return false;
+    }
+    return true;
+}
+
+static const scpi_index_node_t *find_child(const scpi_index_node_t *node, const char *mnemonic, size_t len)
+{
+    const uint8_t *children = &g_scpi_index_children[node->children];
+    size_t low = 0;
+    size_t high = node->child_count;
+
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        const scpi_index_node_t *child = &g_scpi_index[children[mid]];
+        int diff = compare_short(mnemonic, len, child);
+
+        if (diff == 0)
+            return match_long(mnemonic, len, child) ? child : NULL;
+        else if (diff < 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return NULL;
+}
+
+int scpi_dispatch_find(const char *header, size_t len)
+{
+    if (len > 0 && header[0] == ':')
+    {
+        header++;
+        len--;
+    }
+
+    bool query = (len > 0 && header[len - 1] == '?');
+    if (query)
+        len--;
+
+    const scpi_index_node_t *node = &g_scpi_index[0];
+    const char *end = header + len;
+    const char *colon;
+
+    do
+    {
+        colon = memchr(header, ':', end - header);
+        const char *next = colon ? colon : end;
+
+        node = find_child(node, header, next - header);
+        if (!node)
+            return -1;
+
+        header = next + 1;
+    } while (colon);
+
+    return query ? node->query : node->command;
+}
+
+/******************************************
+ * Line scanning                          *
+ ******************************************/
+
+// Received data is followed just far enough to find the headers and the line
+// ends the way the parser does: headers end at whitespace, message units at
+// ';' outside of strings and definite length blocks, lines at '\n'.
+// Anything else, such as an unknown header, sends the line to the full table.
+// So does a '\n' in a string or block, the parser and the scanner then agree
+// again at the next line end whether or not the parser ended the line there.
+
+typedef enum {
+    SCAN_UNIT,          // Before the header of a message unit
+    SCAN_HEADER,
+    SCAN_DATA,
+    SCAN_STRING,
+    SCAN_BLOCK_HASH,    // After '#' in data
+    SCAN_BLOCK_DIGITS,  // In the length of a definite length block
+    SCAN_BLOCK,
+} scan_state_t;
+
+static struct {
+    scan_state_t state;
+    char quote;
+    uint8_t block_digits;
+    uint32_t block_length;
+
+    // Header being scanned, after the path of the previous header when it
+    // is relative, see header_start()
+    char header[SCPI_DISPATCH_HEADER_MAX];
+    size_t header_len;
+    size_t path_len;
+
+    size_t line_len;        // Line length buffered by the parser
+    bool unresolved;        // Line is searched in the full table
+    size_t command_count;
+    scpi_command_t commands[SCPI_DISPATCH_LINE_COMMANDS + 1];
+} g_scan;
+
+static void line_reset(void)
+{
+    g_scan.state = SCAN_UNIT;
+    g_scan.header_len = 0;
+    g_scan.path_len = 0;
+    g_scan.line_len = 0;
+    g_scan.unresolved = false;
+    g_scan.command_count = 0;
+    g_scan.commands[0].pattern = NULL;
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool is_header_char(char c)
+{
+    char upper = to_upper(c);
+    return (upper >= 'A' && upper <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_' || c == ':' || c == '*' || c == '?';
+}
+
+// A relative header in a compound command continues the path of the
+// previous one, up to its last ':', unless that was a common command
+static void header_start(char c)
+{
+    g_scan.header_len = (c == '*' || c == ':') ? 0 : g_scan.path_len;
+    g_scan.state = SCAN_HEADER;
+}
+
+static void header_end(void)
+{
+    g_scan.state = SCAN_DATA;
+    if (g_scan.unresolved)
+        return;
+
+    int index = scpi_dispatch_find(g_scan.header, g_scan.header_len);
+    if (index < 0)
+    {
+        g_scan.unresolved = true;
+        return;
+    }
+
+    g_scan.path_len = 0;
+    if (g_scan.header[0] != '*')
+    {
+        for (size_t i = g_scan.header_len; i > 0; i--)
+        {
+            if (g_scan.header[i - 1] == ':')
+            {
+                g_scan.path_len = i;
+                break;
+            }
+        }
+    }
+
+    const scpi_command_t *command = &g_scpi_commands[index];
+    for (size_t i = 0; i < g_scan.command_count; i++)
+    {
+        if (g_scan.commands[i].pattern == command->pattern)
+            return;
+    }
+
+    if (g_scan.command_count == SCPI_DISPATCH_LINE_COMMANDS)
+    {
+        g_scan.unresolved = true;
+        return;
+    }
+
+    g_scan.commands[g_scan.command_count++] = *command;
+    g_scan.commands[g_scan.command_count].pattern = NULL;
+}
+
+// Returns true at the end of the line
+static bool scan_char(char c)
+{
+    switch (g_scan.state)
+    {
+    case SCAN_UNIT:
+        if (c == '\n')
+            return true;
+        if (c == ';' || is_space(c))
+            return false;
+        header_start(c);
+        // fall through
+
+    case SCAN_HEADER:
+        if (is_header_char(c))
+        {
+            if (g_scan.header_len < sizeof(g_scan.header))
+                g_scan.header[g_scan.header_len++] = c;
+            else
+                g_scan.unresolved = true;
+            return false;
+        }
+
+        if (!is_space(c) && c != ';')
+            g_scan.unresolved = true;
+        header_end();
+        return scan_char(c);
+
+    case SCAN_DATA:
+        if (c == '\n')
+            return true;
+        if (c == ';')
+            g_scan.state = SCAN_UNIT;
+        else if (c == '"' || c == '\'')
+        {
+            g_scan.quote = c;
+            g_scan.state = SCAN_STRING;
+        }
+        else if (c == '#')
+            g_scan.state = SCAN_BLOCK_HASH;
+        return false;
+
+    case SCAN_STRING:
+        // A doubled quote leaves and enters the string again
+        if (c == g_scan.quote)
+            g_scan.state = SCAN_DATA;
+        else if (c == '\n')
+            g_scan.unresolved = true;
+        return false;
+
+    case SCAN_BLOCK_HASH:
+        // #0 blocks end at the line end, #H, #Q and #B start numbers
+        if (c < '1' || c > '9')
+        {
+            g_scan.state = SCAN_DATA;
+            return scan_char(c);
+        }
+        g_scan.block_digits = c - '0';
+        g_scan.block_length = 0;
+        g_scan.state = SCAN_BLOCK_DIGITS;
+        return false;
+
+    case SCAN_BLOCK_DIGITS:
+        if (c < '0' || c > '9')
+        {
+            g_scan.unresolved = true;
+            g_scan.state = SCAN_DATA;
+            return scan_char(c);
+        }
+        g_scan.block_length = g_scan.block_length * 10 + (c - '0');
+        if (--g_scan.block_digits == 0)
+            g_scan.state = g_scan.block_length ? SCAN_BLOCK : SCAN_DATA;
+        return false;
+
+    case SCAN_BLOCK:
+        if (c == '\n')
+            g_scan.unresolved = true;
+        if (--g_scan.block_length == 0)
+            g_scan.state = SCAN_DATA;
+        return false;
+    }
+
+    return false;
+}
+
+void scpi_dispatch_input(scpi_t *context, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        size_t count = 0;
+        bool line_end = false;
+        while (count < len && !line_end)
+            line_end = scan_char(data[count++]);
+
+        // The parser discards input that does not fit its buffer, and
+        // continues the line from there
+        if (g_scan.line_len + count > SCPI_INPUT_BUFFER_LENGTH - 1)
+        {
+            g_scan.unresolved = true;
+            g_scan.line_len = 0;
+        }
+        else
+        {
+            g_scan.line_len += count;
+        }
+
+        // The parser only searches for commands once the line is complete
+        if (line_end && !g_scan.unresolved)
+            context->cmdlist = g_scan.commands;
+        SCPI_Input(context, data, count);
+        context->cmdlist = g_scpi_commands;
+
+        if (line_end)
+            line_reset();
+
+        data += count;
+        len -= count;
+    }
+}
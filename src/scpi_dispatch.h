@@ -0,0 +1,27 @@
+// Command header lookup through an index generated from g_scpi_commands at
+// build time by scripts/gen_scpi_index.py. Its cost depends on the number of
+// nodes in a header, not on the position of the command in the table.
+//
+// scpi-parser itself only searches the list in context->cmdlist linearly.
+// scpi_dispatch_input() therefore looks up the headers of each line before
+// passing it on, and lets the parser search only the few commands the line
+// uses. Lines it cannot follow are searched in the full table as before.
+
+#pragma once
+
+#include "scpi/scpi.h"
+#include <stddef.h>
+
+// Most distinct commands in a line searched through the index
+#define SCPI_DISPATCH_LINE_COMMANDS 8
+
+// Longest header, including the path of a compound command, searched
+// through the index
+#define SCPI_DISPATCH_HEADER_MAX 48
+
+// Index in g_scpi_commands of the command matching a complete header such
+// as ":ROUTe:CLOS?", or -1 if none does
+int scpi_dispatch_find(const char *header, size_t len);
+
+// Pass received data to SCPI_Input()
+void scpi_dispatch_input(scpi_t *context, const char *data, size_t len);
@@ -1,8 +1,12 @@
-// Connect USB serial port into SCPI parser
+// Connect USB serial port into SCPI parser, and vendor-specific
+// bulk interface into binary control protocol.
 
 #include "usb_serial.h"
 #include "board.h"
 #include "scpi_commands.h"
+#include "scpi_dispatch.h"
+#include "binary_control.h"
+#include "perf.h"
 
 #include <stm32f042x6.h>
 #include <stm32f0xx_hal.h>
@@ -22,9 +26,9 @@ uint8_t *GetDeviceDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
         0x12,                       /* bLength */
         USB_DESC_TYPE_DEVICE,
         0x00, 0x02,                 /* bcdUSB */
-        0x02,                       /* bDeviceClass */
-        0x02,                       /* bDeviceSubClass */
-        0x00,                       /* bDeviceProtocol */
+        0xEF,                       /* bDeviceClass: Miscellaneous */
+        0x02,                       /* bDeviceSubClass: Common Class */
+        0x01,                       /* bDeviceProtocol: Interface Association */
         USB_MAX_EP0_SIZE,           /* bMaxPacketSize */
         0x83, 0x04,                 /* idVendor */
         0x40, 0x56,                 /* idProduct */
@@ -82,6 +86,88 @@ uint8_t *GetInterfaceStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
     return g_usb_strbuf;
 }
 
+// Composite configuration: CDC-ACM (interfaces 0 and 1) grouped with an
+// interface association, and vendor-specific binary control interface 2.
+#define BIN_OUT_EP          0x03
+#define BIN_IN_EP           0x83
+#define BIN_PACKET_SIZE     64
+
+static uint8_t g_usb_config_desc[] =
+{
+    /* Configuration */
+    0x09, USB_DESC_TYPE_CONFIGURATION,
+    98, 0x00,                   /* wTotalLength */
+    0x03,                       /* bNumInterfaces */
+    0x01,                       /* bConfigurationValue */
+    0x00,                       /* iConfiguration */
+    0x80,                       /* bmAttributes: bus powered */
+    150,                        /* bMaxPower: 300 mA */
+
+    /* Interface association: CDC */
+    0x08, 0x0B,
+    0x00,                       /* bFirstInterface */
+    0x02,                       /* bInterfaceCount */
+    0x02, 0x02, 0x01,           /* Class: CDC, ACM, AT commands */
+    0x00,                       /* iFunction */
+
+    /* Interface 0: CDC communication */
+    0x09, USB_DESC_TYPE_INTERFACE,
+    0x00, 0x00,                 /* bInterfaceNumber, bAlternateSetting */
+    0x01,                       /* bNumEndpoints */
+    0x02, 0x02, 0x01,           /* Class: CDC, ACM, AT commands */
+    0x00,                       /* iInterface */
+
+    0x05, 0x24, 0x00, 0x10, 0x01,       /* Header functional descriptor */
+    0x05, 0x24, 0x01, 0x00, 0x01,       /* Call management functional descriptor */
+    0x04, 0x24, 0x02, 0x02,             /* ACM functional descriptor */
+    0x05, 0x24, 0x06, 0x00, 0x01,       /* Union functional descriptor */
+
+    0x07, USB_DESC_TYPE_ENDPOINT,
+    CDC_CMD_EP, 0x03,           /* bEndpointAddress, bmAttributes: interrupt */
+    CDC_CMD_PACKET_SIZE, 0x00,
+    0x01,                       /* bInterval: service requests are latency sensitive */
+
+    /* Interface 1: CDC data */
+    0x09, USB_DESC_TYPE_INTERFACE,
+    0x01, 0x00,
+    0x02,
+    0x0A, 0x00, 0x00,           /* Class: CDC data */
+    0x00,
+
+    0x07, USB_DESC_TYPE_ENDPOINT,
+    CDC_OUT_EP, 0x02,           /* bulk */
+    CDC_DATA_FS_MAX_PACKET_SIZE, 0x00,
+    0x00,
+
+    0x07, USB_DESC_TYPE_ENDPOINT,
+    CDC_IN_EP, 0x02,
+    CDC_DATA_FS_MAX_PACKET_SIZE, 0x00,
+    0x00,
+
+    /* Interface 2: binary control */
+    0x09, USB_DESC_TYPE_INTERFACE,
+    0x02, 0x00,
+    0x02,
+    0xFF, 0x00, 0x00,           /* Class: vendor specific */
+    0x00,
+
+    0x07, USB_DESC_TYPE_ENDPOINT,
+    BIN_OUT_EP, 0x02,
+    BIN_PACKET_SIZE, 0x00,
+    0x00,
+
+    0x07, USB_DESC_TYPE_ENDPOINT,
+    BIN_IN_EP, 0x02,
+    BIN_PACKET_SIZE, 0x00,
+    0x00,
+};
+
+static uint8_t *GetConfigDescriptor(uint16_t *length)
+{
+    *length = sizeof(g_usb_config_desc);
+    return g_usb_config_desc;
+}
+
 static USBD_DescriptorsTypeDef g_usb_descriptor = {
     GetDeviceDescriptor,
     GetLangIDStrDescriptor,
@@ -96,13 +182,181 @@ static USBD_DescriptorsTypeDef g_usb_descriptor = {
  * CDC-ACM serial data transfer           *
  ******************************************/
 
-#define CDC_BUFSIZE 128
-static uint8_t g_cdc_rxbuf[CDC_BUFSIZE];
-static volatile size_t g_cdc_rxsize;
+// Receive ring of packet-sized slots.
+// The USB interrupt receives directly into the slot at head, and the main loop
+// feeds scpi_dispatch_input() directly from the slot at tail. When all slots
+// are full, reception is left unarmed so that the OUT endpoint NAKs until the
+// main loop frees a slot.
+#define CDC_RX_SLOTS 4
+typedef struct {
+    uint8_t data[CDC_DATA_FS_MAX_PACKET_SIZE];
+    uint32_t len;
+    uint32_t received; // perf_now() at reception
+} cdc_rxslot_t;
+
+static cdc_rxslot_t g_cdc_rx[CDC_RX_SLOTS];
+static volatile uint32_t g_cdc_rx_head; // Advanced by USB interrupt
+static volatile uint32_t g_cdc_rx_tail; // Advanced by usb_serial_poll()
+static volatile bool g_cdc_rx_paused;   // Reception not armed due to full ring
+
+// Arm reception into next free slot, or pause if there is none.
+static void CDC_ArmReceive(void)
+{
+    uint32_t head = g_cdc_rx_head;
+    if (head - g_cdc_rx_tail < CDC_RX_SLOTS)
+    {
+        g_cdc_rx_paused = false;
+        USBD_CDC_SetRxBuffer(&g_usb_dev, g_cdc_rx[head % CDC_RX_SLOTS].data);
+        USBD_CDC_ReceivePacket(&g_usb_dev);
+    }
+    else
+    {
+        g_cdc_rx_paused = true;
+    }
+}
+
+// Transmit ring.
+// SCPI_Write() appends to head, and each completed IN transfer advances tail
+// and starts the next one from the USB interrupt. Transfers longer than one
+// packet are split by the driver, and a zero-length packet terminates the
+// response when the last transfer was a multiple of the packet size.
+#define CDC_TX_BUFSIZE SCPI_OUTPUT_BUFFER_LENGTH
+static uint8_t g_cdc_tx[CDC_TX_BUFSIZE];
+static volatile uint32_t g_cdc_tx_head;     // Advanced by SCPI_Write()
+static volatile uint32_t g_cdc_tx_tail;     // Advanced by transfer completion
+static volatile uint32_t g_cdc_tx_inflight; // Length of active transfer
+static volatile bool g_cdc_tx_busy;
+static volatile bool g_cdc_tx_zlp;          // Active transfer is a zero-length packet
+static uint32_t g_cdc_tx_started;           // perf_now() when active transfer was started
+static volatile bool g_cdc_tx_stalled;      // Host stopped reading, see SCPI_Write()
+
+// SCPI_Write() drops output if no IN transfer completes for this long while
+// the ring is full, so a host that stops reading cannot hang the firmware.
+#define CDC_TX_TIMEOUT_MS 100
+
+// Start next transfer if the endpoint is idle.
+// Called from USB interrupt, or from main context with USB interrupt disabled.
+static void CDC_StartTransmit(void)
+{
+    if (g_cdc_tx_busy)
+        return;
+
+    uint32_t tail = g_cdc_tx_tail;
+    uint32_t len = g_cdc_tx_head - tail;
+    uint32_t offset = tail % CDC_TX_BUFSIZE;
+
+    if (len == 0)
+        return;
+
+    if (offset + len > CDC_TX_BUFSIZE)
+    {
+        // Send up to the end of buffer, rest follows in next transfer
+        len = CDC_TX_BUFSIZE - offset;
+    }
+
+    g_cdc_tx_busy = true;
+    g_cdc_tx_zlp = false;
+    g_cdc_tx_inflight = len;
+    g_cdc_tx_started = perf_now();
+    USBD_LL_Transmit(&g_usb_dev, CDC_IN_EP, g_cdc_tx + offset, len);
+}
+
+static void CDC_TransmitComplete(void)
+{
+    perf_record(PERF_TX, g_cdc_tx_started);
+    g_cdc_tx_busy = false;
+    g_cdc_tx_stalled = false;
+
+    if (g_cdc_tx_zlp)
+    {
+        g_cdc_tx_zlp = false;
+    }
+    else
+    {
+        uint32_t len = g_cdc_tx_inflight;
+        g_cdc_tx_tail += len;
+        g_cdc_tx_inflight = 0;
+
+        if (g_cdc_tx_tail == g_cdc_tx_head && len % CDC_DATA_FS_MAX_PACKET_SIZE == 0)
+        {
+            // Host would wait for more data after a full packet
+            g_cdc_tx_busy = true;
+            g_cdc_tx_zlp = true;
+            g_cdc_tx_started = perf_now();
+            USBD_LL_Transmit(&g_usb_dev, CDC_IN_EP, NULL, 0);
+            return;
+        }
+    }
+
+    CDC_StartTransmit();
+}
+
+static void CDC_Flush(void)
+{
+    HAL_NVIC_DisableIRQ(USB_IRQn);
+    CDC_StartTransmit();
+    HAL_NVIC_EnableIRQ(USB_IRQn);
+}
+
+// Service requests are signalled with a SERIAL_STATE notification on the
+// interrupt endpoint, toggling the ring indicator each time. Host drivers
+// count ring changes, so software can block on them (TIOCMIWAIT on Linux)
+// and then read *STB? instead of polling.
+#define CDC_SERIAL_STATE        0x20
+#define CDC_SERIAL_STATE_RING   0x08
+static uint8_t g_cdc_notify[10] = {
+    0xA1, CDC_SERIAL_STATE,     /* bmRequestType, bNotification */
+    0x00, 0x00,                 /* wValue */
+    0x00, 0x00,                 /* wIndex: communication interface */
+    0x02, 0x00,                 /* wLength */
+    0x00, 0x00                  /* UART state bitmap */
+};
+static volatile bool g_cdc_notify_busy;
+static volatile bool g_cdc_notify_pending; // Request arrived while busy
+
+// Called from USB interrupt, or from main context with USB interrupt disabled.
+static void CDC_Notify(void)
+{
+    if (g_cdc_notify_busy)
+    {
+        g_cdc_notify_pending = true;
+        return;
+    }
+
+    g_cdc_notify_pending = false;
+    g_cdc_notify_busy = true;
+    g_cdc_notify[8] ^= CDC_SERIAL_STATE_RING;
+    USBD_LL_Transmit(&g_usb_dev, CDC_CMD_EP, g_cdc_notify, sizeof(g_cdc_notify));
+}
+
+static void CDC_NotifyComplete(void)
+{
+    g_cdc_notify_busy = false;
+    if (g_cdc_notify_pending)
+    {
+        CDC_Notify();
+    }
+}
 
 static int8_t CDC_Init(void)
 {
-    USBD_CDC_SetRxBuffer(&g_usb_dev, g_cdc_rxbuf);
+    // Data queued before (re)enumeration is discarded
+    g_cdc_tx_tail = g_cdc_tx_head;
+    g_cdc_tx_busy = false;
+    g_cdc_tx_stalled = false;
+    g_cdc_tx_zlp = false;
+    g_cdc_notify_busy = false;
+    g_cdc_notify_pending = false;
+
+    // CDC class arms the first reception after this returns, so the slot at
+    // head must be free. If the ring filled up before re-enumeration, the
+    // newest unread packet is dropped: the slot at tail may be in use by
+    // usb_serial_poll(), and head is only advanced from this interrupt.
+    if (g_cdc_rx_head - g_cdc_rx_tail >= CDC_RX_SLOTS)
+        g_cdc_rx_head--;
+    g_cdc_rx_paused = false;
+
+    USBD_CDC_SetRxBuffer(&g_usb_dev, g_cdc_rx[g_cdc_rx_head % CDC_RX_SLOTS].data);
     USBD_CDC_SetTxBuffer(&g_usb_dev, NULL, 0);
     return USBD_OK;
 }
@@ -119,20 +373,132 @@ static int8_t CDC_Control(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 
 static int8_t CDC_Receive(uint8_t* buf, uint32_t *len)
 {
-    if (*len < sizeof(g_cdc_rxbuf) - g_cdc_rxsize)
+    cdc_rxslot_t *slot = &g_cdc_rx[g_cdc_rx_head % CDC_RX_SLOTS];
+    slot->len = *len;
+    slot->received = perf_now();
+    g_cdc_rx_head++;
+    CDC_ArmReceive();
+    board_wake();
+    return USBD_OK;
+}
+
+static USBD_CDC_ItfTypeDef g_cdc_interface = {
+    CDC_Init, CDC_DeInit, CDC_Control, CDC_Receive
+};
+
+/******************************************
+ * Binary control interface               *
+ ******************************************/
+
+// One OUT packet is processed at a time. Reception is re-armed only after the
+// acks for the previous packet have been queued, so the endpoint NAKs meanwhile.
+static uint8_t g_bin_rxbuf[BIN_PACKET_SIZE];
+static volatile uint32_t g_bin_rxlen;
+static volatile bool g_bin_rx_ready;
+static uint8_t g_bin_txbuf[BIN_PACKET_SIZE / BINCTRL_REQUEST_SIZE * BINCTRL_ACK_SIZE];
+static volatile bool g_bin_tx_busy;
+
+static void BIN_Init(USBD_HandleTypeDef *pdev)
+{
+    USBD_LL_OpenEP(pdev, BIN_OUT_EP, USBD_EP_TYPE_BULK, BIN_PACKET_SIZE);
+    USBD_LL_OpenEP(pdev, BIN_IN_EP, USBD_EP_TYPE_BULK, BIN_PACKET_SIZE);
+    g_bin_rx_ready = false;
+    g_bin_tx_busy = false;
+    USBD_LL_PrepareReceive(pdev, BIN_OUT_EP, g_bin_rxbuf, BIN_PACKET_SIZE);
+}
+
+static void BIN_DeInit(USBD_HandleTypeDef *pdev)
+{
+    USBD_LL_CloseEP(pdev, BIN_OUT_EP);
+    USBD_LL_CloseEP(pdev, BIN_IN_EP);
+}
+
+static void BIN_Poll(void)
+{
+    if (!g_bin_rx_ready || g_bin_tx_busy)
+        return;
+
+    uint32_t count = g_bin_rxlen / BINCTRL_REQUEST_SIZE;
+    for (uint32_t i = 0; i < count; i++)
     {
-        USBD_CDC_SetRxBuffer(&g_usb_dev, g_cdc_rxbuf + g_cdc_rxsize);
-        USBD_CDC_ReceivePacket(&g_usb_dev);
-        g_cdc_rxsize += *len;
+        binctrl_request_t req;
+        binctrl_ack_t ack;
+        memcpy(&req, g_bin_rxbuf + i * BINCTRL_REQUEST_SIZE, sizeof(req));
+        binctrl_execute(&req, &ack);
+        memcpy(g_bin_txbuf + i * BINCTRL_ACK_SIZE, &ack, sizeof(ack));
+    }
+
+    HAL_NVIC_DisableIRQ(USB_IRQn);
+    if (count > 0)
+    {
+        g_bin_tx_busy = true;
+        USBD_LL_Transmit(&g_usb_dev, BIN_IN_EP, g_bin_txbuf, count * BINCTRL_ACK_SIZE);
+    }
+    g_bin_rx_ready = false;
+    USBD_LL_PrepareReceive(&g_usb_dev, BIN_OUT_EP, g_bin_rxbuf, BIN_PACKET_SIZE);
+    HAL_NVIC_EnableIRQ(USB_IRQn);
+}
+
+/******************************************
+ * Composite class                        *
+ ******************************************/
+
+// CDC class extended with the binary control interface.
+// CDC transmit completion is routed to CDC_TransmitComplete(). Transfers
+// are started with USBD_LL_Transmit() directly, so the CDC class itself
+// never queues packets on the IN endpoint.
+static USBD_ClassTypeDef g_usb_class;
+
+static uint8_t USB_ClassInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+    uint8_t status = USBD_CDC.Init(pdev, cfgidx);
+    BIN_Init(pdev);
+    return status;
+}
+
+static uint8_t USB_ClassDeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+    BIN_DeInit(pdev);
+    return USBD_CDC.DeInit(pdev, cfgidx);
+}
+
+static uint8_t USB_ClassDataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+    if (epnum == (BIN_IN_EP & 0x7F))
+    {
+        g_bin_tx_busy = false;
+        board_wake(); // Next request packet may be waiting
+        return USBD_OK;
+    }
+
+    if (epnum == (CDC_CMD_EP & 0x7F))
+    {
+        CDC_NotifyComplete();
+        return USBD_OK;
+    }
+
+    USBD_CDC.DataIn(pdev, epnum);
+
+    if (epnum == (CDC_IN_EP & 0x7F))
+    {
+        CDC_TransmitComplete();
     }
 
     return USBD_OK;
 }
 
+static uint8_t USB_ClassDataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+    if (epnum == BIN_OUT_EP)
+    {
+        g_bin_rxlen = USBD_LL_GetRxDataSize(pdev, epnum);
+        g_bin_rx_ready = true;
+        board_wake();
+        return USBD_OK;
+    }
 
-static USBD_CDC_ItfTypeDef g_cdc_interface = {
-    CDC_Init, CDC_DeInit, CDC_Control, CDC_Receive
-};
+    return USBD_CDC.DataOut(pdev, epnum);
+}
 
 /******************************************
  * SCPI parser                            *
@@ -140,38 +506,114 @@ static USBD_CDC_ItfTypeDef g_cdc_interface = {
 
 static scpi_t g_scpi_context;
 static char g_scpi_inbuf[SCPI_INPUT_BUFFER_LENGTH];
-static char g_scpi_outbuf[SCPI_INPUT_BUFFER_LENGTH];
-static size_t g_scpi_outbuf_len;
 static scpi_error_t g_scpi_error_queue[SCPI_ERROR_QUEUE_SIZE];
 
 size_t SCPI_Write(scpi_t * context, const char * data, size_t len)
 {
-    int pos = 0;
-    while (pos < len && g_scpi_outbuf_len < sizeof(g_scpi_outbuf))
+    size_t pos = 0;
+    uint32_t tail = g_cdc_tx_tail;
+    uint32_t waiting_since = HAL_GetTick();
+    while (pos < len)
     {
-        g_scpi_outbuf[g_scpi_outbuf_len++] = data[pos++];
+        uint32_t head = g_cdc_tx_head;
+        uint32_t space = CDC_TX_BUFSIZE - (head - g_cdc_tx_tail);
+
+        if (space == 0)
+        {
+            if (g_usb_dev.dev_state != USBD_STATE_CONFIGURED || g_cdc_tx_stalled)
+            {
+                // Nobody is reading, drop the rest
+                break;
+            }
+
+            if (g_cdc_tx_tail != tail)
+            {
+                tail = g_cdc_tx_tail;
+                waiting_since = HAL_GetTick();
+            }
+            else if (HAL_GetTick() - waiting_since >= CDC_TX_TIMEOUT_MS)
+            {
+                // Host stopped reading. Drop output until the next transfer
+                // completes, instead of waiting again on every write.
+                g_cdc_tx_stalled = true;
+                break;
+            }
+
+            // Wait for transmission to free up space
+            CDC_Flush();
+            __WFI();
+            continue;
+        }
+
+        g_cdc_tx[head % CDC_TX_BUFSIZE] = data[pos++];
+        g_cdc_tx_head = head + 1;
     }
 
     return pos;
 }
 
+scpi_result_t SCPI_Flush(scpi_t * context)
+{
+    CDC_Flush();
+    return SCPI_RES_OK;
+}
+
+// Errors are written as soon as they occur as code and message,
+// e.g. -222,"Data out of range", so that hosts can tell them from results.
+// The parser also reports code 0 when the queue is cleared, which is skipped.
 int SCPI_Error(scpi_t * context, int_fast16_t err)
 {
+    if (err == 0)
+        return 0;
+
+    char code[8];
+    size_t pos = sizeof(code);
+    uint32_t value = (err < 0) ? -err : err;
+    do
+    {
+        code[--pos] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    if (err < 0)
+        code[--pos] = '-';
+
     const char *errtxt = SCPI_ErrorTranslate(err);
+    SCPI_Write(context, code + pos, sizeof(code) - pos);
+    SCPI_Write(context, ",\"", 2);
     SCPI_Write(context, errtxt, strlen(errtxt));
-    SCPI_Write(context, "\r\n", 2);
+    SCPI_Write(context, "\"\r\n", 3);
     return 0;
 }
 
+scpi_result_t SCPI_Control(scpi_t * context, scpi_ctrl_name_t ctrl, scpi_reg_val_t val)
+{
+    if (ctrl == SCPI_CTRL_SRQ && g_usb_dev.dev_state == USBD_STATE_CONFIGURED)
+    {
+        HAL_NVIC_DisableIRQ(USB_IRQn);
+        CDC_Notify();
+        HAL_NVIC_EnableIRQ(USB_IRQn);
+    }
+    return SCPI_RES_OK;
+}
+
 static scpi_interface_t g_scpi_interface = {
     .write = SCPI_Write,
     .error = SCPI_Error,
+    .control = SCPI_Control,
+    .flush = SCPI_Flush,
 };
 
 void usb_serial_start()
 {
     USBD_Init(&g_usb_dev, &g_usb_descriptor, 0);
-    USBD_RegisterClass(&g_usb_dev, &USBD_CDC);
+    g_usb_class = USBD_CDC;
+    g_usb_class.Init = USB_ClassInit;
+    g_usb_class.DeInit = USB_ClassDeInit;
+    g_usb_class.DataIn = USB_ClassDataIn;
+    g_usb_class.DataOut = USB_ClassDataOut;
+    g_usb_class.GetFSConfigDescriptor = GetConfigDescriptor;
+    g_usb_class.GetOtherSpeedConfigDescriptor = GetConfigDescriptor;
+    USBD_RegisterClass(&g_usb_dev, &g_usb_class);
     USBD_CDC_RegisterInterface(&g_usb_dev, &g_cdc_interface);
     USBD_Start(&g_usb_dev);
 
@@ -186,25 +628,36 @@ void usb_serial_start()
 
 void usb_serial_poll()
 {
-    size_t len = g_cdc_rxsize;
-    if (len > 0)
-    {
-        SCPI_Input(&g_scpi_context, (const char*)g_cdc_rxbuf, g_cdc_rxsize);
+    BIN_Poll();
+    scpi_commands_poll(&g_scpi_context);
 
-        __disable_irq();
-        if (g_cdc_rxsize > len)
+    if (g_cdc_rx_tail != g_cdc_rx_head)
+    {
+        while (g_cdc_rx_tail != g_cdc_rx_head)
         {
-            // Got more data while was handling previous
-            memcpy(g_cdc_rxbuf, g_cdc_rxbuf + len, g_cdc_rxsize - len);
+            cdc_rxslot_t *slot = &g_cdc_rx[g_cdc_rx_tail % CDC_RX_SLOTS];
+            if (slot->len > 0)
+            {
+                perf_record(PERF_RX, slot->received);
+                uint32_t start = perf_now();
+                scpi_dispatch_input(&g_scpi_context, (const char*)slot->data, slot->len);
+                perf_record(PERF_PARSE, start);
+            }
+            g_cdc_rx_tail++;
+
+            if (g_cdc_rx_paused)
+            {
+                // Slot is now free, resume reception unless re-enumeration
+                // armed it meanwhile
+                HAL_NVIC_DisableIRQ(USB_IRQn);
+                if (g_cdc_rx_paused)
+                    CDC_ArmReceive();
+                HAL_NVIC_EnableIRQ(USB_IRQn);
+            }
         }
-        g_cdc_rxsize = 0;
-        __enable_irq();
 
-        if (g_scpi_outbuf_len > 0)
-        {
-            USBD_CDC_SetTxBuffer(&g_usb_dev, (uint8_t*)g_scpi_outbuf, g_scpi_outbuf_len);
-            USBD_CDC_TransmitPacket(&g_usb_dev);
-            g_scpi_outbuf_len = 0;
-        }
+        // Pick up status changes caused by the commands
+        scpi_commands_poll(&g_scpi_context);
+        CDC_Flush();
     }
 }
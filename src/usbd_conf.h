@@ -8,20 +8,24 @@
 #include <string.h>
 #include <stdarg.h>
 
-#define USBD_MAX_NUM_INTERFACES               1U
+#define USBD_MAX_NUM_INTERFACES               3U
 #define USBD_MAX_NUM_CONFIGURATION            1U
 #define USBD_MAX_STR_DESC_SIZ                 0x20U
 #define USBD_SUPPORT_USER_STRING_DESC         1U
 #define USBD_SELF_POWERED                     0U
 
 #define USBD_CDC_INTERVAL                      2000U
-#define USBD_malloc               malloc
-#define USBD_free                 free
+#define USBD_malloc               USBD_static_malloc
+#define USBD_free                 USBD_static_free
 #define USBD_memset               memset
 #define USBD_memcpy               memcpy
 
 #define USBD_DEBUG_LEVEL           2U
 
+// Class data comes from a static block, see usbd_ll.c
+void *USBD_static_malloc(uint32_t size);
+void USBD_static_free(void *p);
+
 
 void board_log(const char *data);
 #define USBD_UsrLog(fmt, ...) board_log(fmt)
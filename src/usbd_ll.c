@@ -1,6 +1,8 @@
 // Low level driver interface used by STM32 USB driver
 
 #include "usbd_core.h"
+#include "usbd_cdc.h"
+#include <stdbool.h>
 
 PCD_HandleTypeDef g_pcd_handle;
 
@@ -27,7 +29,7 @@ void HAL_PCD_MspInit(PCD_HandleTypeDef *hpcd)
     __HAL_RCC_USB_RELEASE_RESET();
     HAL_Delay(1);
     
-    HAL_NVIC_SetPriority(USB_IRQn, 3, 0);
+    HAL_NVIC_SetPriority(USB_IRQn, 2, 0); // Above PendSV, see board_init()
     HAL_NVIC_EnableIRQ(USB_IRQn);
 }
 
@@ -44,7 +46,7 @@ USBD_StatusTypeDef  USBD_LL_Init(USBD_HandleTypeDef *pdev)
 
     g_pcd_handle.Instance = USB;
     g_pcd_handle.Init.speed = PCD_SPEED_FULL;
-    g_pcd_handle.Init.dev_endpoints = 3;
+    g_pcd_handle.Init.dev_endpoints = 4;
     g_pcd_handle.Init.ep0_mps = USB_MAX_EP0_SIZE;
     g_pcd_handle.Init.phy_itface = PCD_PHY_EMBEDDED;
     g_pcd_handle.Init.Sof_enable = ENABLE;
@@ -65,11 +67,35 @@ USBD_StatusTypeDef  USBD_LL_Init(USBD_HandleTypeDef *pdev)
     HAL_PCDEx_PMAConfig(&g_pcd_handle, 0x80, PCD_SNG_BUF, 0x100 + 64 * 4);
     HAL_PCDEx_PMAConfig(&g_pcd_handle, 0x81, PCD_SNG_BUF, 0x100 + 64 * 5);
     HAL_PCDEx_PMAConfig(&g_pcd_handle, 0x82, PCD_SNG_BUF, 0x100 + 64 * 6);
-    HAL_PCDEx_PMAConfig(&g_pcd_handle, 0x83, PCD_SNG_BUF, 0x100 + 64 * 6);
+    HAL_PCDEx_PMAConfig(&g_pcd_handle, 0x83, PCD_SNG_BUF, 0x100 + 64 * 7);
 
     return USBD_OK;
 }
 
+// The CDC class allocates its handle in Init and frees it in DeInit, once
+// per enumeration. A static block sized at compile time replaces the heap,
+// so the allocation cannot fail or fragment and shows up in the map file.
+static uint32_t g_usbd_class_data[(sizeof(USBD_CDC_HandleTypeDef) + 3) / 4];
+static bool g_usbd_class_data_used;
+
+void *USBD_static_malloc(uint32_t size)
+{
+    if (size > sizeof(g_usbd_class_data) || g_usbd_class_data_used)
+    {
+        USBD_ErrLog("USBD_malloc");
+        return NULL;
+    }
+
+    g_usbd_class_data_used = true;
+    return g_usbd_class_data;
+}
+
+void USBD_static_free(void *p)
+{
+    if (p == g_usbd_class_data)
+        g_usbd_class_data_used = false;
+}
+
 static USBD_StatusTypeDef USBD_Get_USB_Status(HAL_StatusTypeDef hal_status)
 {
   switch (hal_status)
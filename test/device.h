@@ -0,0 +1,124 @@
+// Helpers for regression tests on simulated hardware.
+// The device is driven through its USB serial port and main loop like the
+// emulator in native/emu does, with simulated time advancing only while a
+// test waits for a reply.
+
+#pragma once
+
+#include "board.h"
+#include "presets.h"
+#include "usb_serial.h"
+#include "sim.h"
+#include <string.h>
+#include <usbd_cdc.h>
+
+// Simulated time allowed for a reply, longer than any relay settle
+#define DEVICE_TIMEOUT_MS 2000
+
+static char g_device_rx[1024];
+static size_t g_device_rxlen;
+
+static inline void device_capture(uint8_t ep_addr, const uint8_t *data, size_t len)
+{
+    if (ep_addr != CDC_IN_EP)
+        return;
+
+    if (len > sizeof(g_device_rx) - g_device_rxlen)
+        len = sizeof(g_device_rx) - g_device_rxlen;
+    memcpy(g_device_rx + g_device_rxlen, data, len);
+    g_device_rxlen += len;
+}
+
+// Power up with relays restored from flash like main() does
+static inline void device_start(void)
+{
+    sim_usb_transmit_hook = device_capture;
+    board_init();
+    set_relay_pwr(true);
+    usb_serial_start();
+
+    relay_mask_t power_on_state;
+    if (presets_init(&power_on_state))
+        relays_set_state(power_on_state, false);
+}
+
+// One iteration of the main loop
+static inline void device_poll(void)
+{
+    usb_serial_poll();
+    presets_poll();
+    while (sim_usb_service());
+}
+
+// Run the main loop for a number of milliseconds
+static inline void device_run(uint32_t ms)
+{
+    for (uint32_t i = 0; i < ms; i++)
+    {
+        device_poll();
+        sim_tick();
+    }
+    device_poll();
+}
+
+// Feed data until the device has accepted all of it
+static inline void device_send(const char *data)
+{
+    size_t len = strlen(data);
+    size_t pos = 0;
+    while (pos < len)
+    {
+        size_t n = sim_usb_receive(data + pos, len - pos);
+        pos += n;
+        device_poll();
+        if (n == 0)
+            sim_tick();
+    }
+}
+
+// Wait for the next reply line and return it without line ending,
+// or NULL if none arrives within timeout_ms of simulated time.
+static inline const char *device_readline(uint32_t timeout_ms)
+{
+    static char line[sizeof(g_device_rx) + 1];
+
+    for (uint32_t waited = 0; ; waited++)
+    {
+        device_poll();
+
+        char *end = memchr(g_device_rx, '\n', g_device_rxlen);
+        if (end)
+        {
+            size_t len = end - g_device_rx + 1;
+            size_t textlen = len - 1;
+            if (textlen > 0 && g_device_rx[textlen - 1] == '\r')
+                textlen--;
+
+            memcpy(line, g_device_rx, textlen);
+            line[textlen] = '\0';
+            g_device_rxlen -= len;
+            memmove(g_device_rx, g_device_rx + len, g_device_rxlen);
+            return line;
+        }
+
+        if (waited >= timeout_ms)
+            return NULL;
+
+        sim_tick();
+    }
+}
+
+// Send a command line and return the first line of the reply
+static inline const char *device_query(const char *command)
+{
+    device_send(command);
+    device_send("\n");
+    return device_readline(DEVICE_TIMEOUT_MS);
+}
+
+// Discard output that has not been read
+static inline void device_flush(void)
+{
+    device_poll();
+    g_device_rxlen = 0;
+}
@@ -0,0 +1,174 @@
+// Header lookup through the generated index: every spelling of every
+// pattern finds its own table entry and nothing else does, and lines
+// dispatched through it behave like lines searched in the full table.
+
+#include <unity.h>
+#include <ctype.h>
+#include <stdio.h>
+#include "../device.h"
+#include "scpi_commands.h"
+#include "scpi_dispatch.h"
+
+void setUp(void)
+{
+    device_query("*RST;*CLS;*OPC?");
+    device_flush();
+}
+
+void tearDown(void)
+{
+}
+
+typedef struct {
+    const char *name;
+    size_t len;
+    bool optional;
+} pattern_node_t;
+
+static int g_spellings;
+
+// Try each node in short and long form, and optional nodes also left out
+static void check_spellings(int index, const pattern_node_t *nodes, int count,
+                            char *header, size_t len, bool query, bool lower, bool absolute)
+{
+    if (count == 0)
+    {
+        char text[SCPI_DISPATCH_HEADER_MAX + 2];
+        size_t total = 0;
+
+        // Also in absolute form
+        if (absolute)
+            text[total++] = ':';
+        for (size_t i = 0; i < len; i++)
+            text[total++] = lower ? tolower((unsigned char)header[i]) : header[i];
+        if (query)
+            text[total++] = '?';
+
+        char message[80];
+        snprintf(message, sizeof(message), "%.*s for %s", (int)total, text, g_scpi_commands[index].pattern);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(index, scpi_dispatch_find(text, total), message);
+        g_spellings++;
+        return;
+    }
+
+    if (nodes->optional)
+        check_spellings(index, nodes + 1, count - 1, header, len, query, lower, absolute);
+
+    size_t short_len = 0;
+    while (short_len < nodes->len && !islower((unsigned char)nodes->name[short_len]))
+        short_len++;
+
+    size_t forms[2] = {short_len, nodes->len};
+    for (int i = 0; i < 2; i++)
+    {
+        if (i == 1 && forms[1] == forms[0])
+            break;
+
+        size_t pos = len;
+        if (pos > 0 && header[0] != '*')
+            header[pos++] = ':';
+        for (size_t j = 0; j < forms[i]; j++)
+            header[pos++] = toupper((unsigned char)nodes->name[j]);
+        check_spellings(index, nodes + 1, count - 1, header, pos, query, lower, absolute);
+    }
+}
+
+static void test_every_spelling_finds_its_command(void)
+{
+    int count = 0;
+    for (; g_scpi_commands[count].pattern; count++)
+    {
+        const char *p = g_scpi_commands[count].pattern;
+        pattern_node_t nodes[8];
+        int node_count = 0;
+
+        while (*p && *p != '?')
+        {
+            pattern_node_t *node = &nodes[node_count++];
+            node->optional = (*p == '[');
+            if (*p == '[')
+                p++;
+            if (*p == ':')
+                p++;
+            node->name = p;
+            while (*p && *p != ':' && *p != '[' && *p != ']' && *p != '?')
+                p++;
+            node->len = p - node->name;
+            if (*p == ']')
+                p++;
+        }
+
+        char header[SCPI_DISPATCH_HEADER_MAX];
+        bool query = (*p == '?');
+        check_spellings(count, nodes, node_count, header, 0, query, false, false);
+        check_spellings(count, nodes, node_count, header, 0, query, true, false);
+        if (nodes[0].name[0] != '*')
+            check_spellings(count, nodes, node_count, header, 0, query, false, true);
+    }
+
+    TEST_ASSERT_GREATER_THAN(3 * count, g_spellings);
+}
+
+static void test_other_headers_find_nothing(void)
+{
+    static const char *const headers[] = {
+        "", ":", "?", "CLO", "CLOSED", "CLOSEX", "ROUT", "ROUT:", "ROUT::CLOS", ":ROUT:CLOS:",
+        "CLOS??", "*OPC:X", "*OP", "OPC?", "SET:BBM:MBB", "ROUT:ROUT:CLOS", "INIT:IMM:IMM", "NOSUCH",
+    };
+
+    for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++)
+        TEST_ASSERT_EQUAL_INT_MESSAGE(-1, scpi_dispatch_find(headers[i], strlen(headers[i])), headers[i]);
+}
+
+static void test_compound_relative_headers(void)
+{
+    TEST_ASSERT_EQUAL_STRING("3;BUS", device_query("TRIG:SOUR BUS;COUN 3;:TRIG:COUN?;SOUR?"));
+    TEST_ASSERT_EQUAL_STRING("0.5", device_query("ROUT:SCAN:DWEL 0.5;DWEL?"));
+
+    // The path comes from the previous header, not from an earlier one
+    TEST_ASSERT_EQUAL_STRING("-113,\"Undefined header\"", device_query("TRIG:COUN 2;*OPC;COUN?"));
+    TEST_ASSERT_EQUAL_STRING("-113,\"Undefined header\"", device_query("TRIG:COUN 2;CLOSE (@1)"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("GET?"));
+}
+
+static void test_lines_beyond_the_index(void)
+{
+    // More distinct commands than searched through the index
+    TEST_ASSERT_EQUAL_STRING("1;0;1;0;0;1", device_query(
+        "CLOSE (@1);CLOSE? (@1);OPEN (@1);GET?;SET 2;CLOSE? (@2);OPEN:ALL;:BEGIN?;MUX:EXCL?;*OPC?"));
+
+    // Undefined header before valid ones
+    TEST_ASSERT_EQUAL_STRING("-113,\"Undefined header\"", device_query("NOSUCH;CLOSE (@3);*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_readline(DEVICE_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL_STRING("4", device_query("GET?"));
+}
+
+static void test_data_that_looks_like_headers(void)
+{
+    // ';' in a string does not end the command
+    TEST_ASSERT_EQUAL_STRING("-224,\"Illegal parameter value\"", device_query("DELETE 'A;B'"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*OPC?"));
+}
+
+static void test_line_over_several_packets(void)
+{
+    // Longer than a USB packet, headers split between packets
+    const char *line = "STAT:OPER:ENAB 2;PTR 0;NTR 2;:TRIG:SOUR IMM;COUN 1;DEL 0;"
+                       ":STAT:OPER:ENAB?;PTR?;NTR?;:TRIG:COUN?";
+    TEST_ASSERT_GREATER_THAN(64, strlen(line));
+    TEST_ASSERT_EQUAL_STRING("2;0;2;1", device_query(line));
+}
+
+int main(int argc, char **argv)
+{
+    device_start();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_every_spelling_finds_its_command);
+    RUN_TEST(test_other_headers_find_nothing);
+    RUN_TEST(test_compound_relative_headers);
+    RUN_TEST(test_lines_beyond_the_index);
+    RUN_TEST(test_data_that_looks_like_headers);
+    RUN_TEST(test_line_over_several_packets);
+    return UNITY_END();
+}
@@ -0,0 +1,81 @@
+// Error reporting on the SCPI serial port: errors are written as
+// <code>,"<message>" lines and must not take the place of query results.
+
+#include <unity.h>
+#include "../device.h"
+
+void setUp(void)
+{
+    device_query("*RST;*CLS;*OPC?");
+    device_flush();
+}
+
+void tearDown(void)
+{
+}
+
+static void test_error_then_valid_query(void)
+{
+    TEST_ASSERT_EQUAL_STRING("-222,\"Data out of range\"", device_query("CLOSE (@99)"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("CLOSE? (@1)"));
+    TEST_ASSERT_NULL(device_readline(100));
+}
+
+static void test_error_before_terminating_query(void)
+{
+    // Like a host library transaction: the error comes first, then the
+    // result of the terminating query on its own line
+    TEST_ASSERT_EQUAL_STRING("-222,\"Data out of range\"", device_query("CLOSE (@99);*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_readline(DEVICE_TIMEOUT_MS));
+}
+
+static void test_error_after_query_result(void)
+{
+    // Output of an earlier query in the same line precedes the error
+    TEST_ASSERT_EQUAL_STRING("0;-222,\"Data out of range\"", device_query("CLOSE? (@1);CLOSE (@99);*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_readline(DEVICE_TIMEOUT_MS));
+}
+
+static void test_undefined_header(void)
+{
+    TEST_ASSERT_EQUAL_STRING("-113,\"Undefined header\"", device_query("NOSUCH"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*OPC?"));
+}
+
+static void test_clear_reports_nothing(void)
+{
+    // Clearing a non-empty error queue must not produce an empty error line
+    TEST_ASSERT_EQUAL_STRING("-222,\"Data out of range\"", device_query("CLOSE (@99)"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*CLS;*OPC?"));
+}
+
+static void test_failed_command_changes_nothing(void)
+{
+    TEST_ASSERT_EQUAL_STRING("-222,\"Data out of range\"", device_query("CLOSE (@1,99)"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("GET?"));
+}
+
+static void test_clear_cancels_pending_opc(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("CLOSE (@1);*OPC;*CLS;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("*ESR?"));
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("OPEN (@1);*OPC;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*ESR?"));
+}
+
+int main(int argc, char **argv)
+{
+    device_start();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_error_then_valid_query);
+    RUN_TEST(test_error_before_terminating_query);
+    RUN_TEST(test_error_after_query_result);
+    RUN_TEST(test_undefined_header);
+    RUN_TEST(test_clear_reports_nothing);
+    RUN_TEST(test_failed_command_changes_nothing);
+    RUN_TEST(test_clear_cancels_pending_opc);
+    return UNITY_END();
+}
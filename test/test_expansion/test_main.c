@@ -0,0 +1,105 @@
+// Channel numbering and masks for any number of expansion boards.
+// Built without expansions in env:test, and with 24 and 56 channels in
+// env:test_exp1 and env:test_exp3, the latter with 64-bit channel masks.
+
+#include <unity.h>
+#include <stdio.h>
+#include "../device.h"
+#include "binary_control.h"
+
+static const char *query_channel(const char *format, unsigned channel)
+{
+    char command[48];
+    snprintf(command, sizeof(command), format, channel);
+    return device_query(command);
+}
+
+static const char *mask_text(relay_mask_t mask)
+{
+    static char text[24];
+    snprintf(text, sizeof(text), "%llu", (unsigned long long)mask);
+    return text;
+}
+
+void setUp(void)
+{
+    device_query("OPEN:ALL;*CLS;*OPC?");
+    device_flush();
+}
+
+void tearDown(void)
+{
+}
+
+static void test_channel_range(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", query_channel("CLOSE (@%u);*OPC?", RELAY_COUNT));
+    TEST_ASSERT_EQUAL_STRING("1", query_channel("CLOSE? (@%u)", RELAY_COUNT));
+    TEST_ASSERT_EQUAL_STRING(mask_text(RELAY_BIT(RELAY_COUNT - 1)), device_query("GET?"));
+
+    TEST_ASSERT_EQUAL_STRING("-222,\"Data out of range\"", query_channel("CLOSE (@%u)", RELAY_COUNT + 1));
+}
+
+static void test_set_full_width(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("SET 0;*OPC?"));
+
+    char command[48];
+    snprintf(command, sizeof(command), "SET %s;*OPC?", mask_text(RELAY_MASK));
+    TEST_ASSERT_EQUAL_STRING("1", device_query(command));
+    TEST_ASSERT_EQUAL_STRING(mask_text(RELAY_MASK), device_query("GET?"));
+}
+
+static void test_state_list(void)
+{
+    char expected[48];
+    snprintf(expected, sizeof(expected), "(@1,%u)", RELAY_COUNT);
+
+    TEST_ASSERT_EQUAL_STRING("1", query_channel("CLOSE (@1,%u);*OPC?", RELAY_COUNT));
+    const char *state = device_query("CLOSE:STAT?");
+    TEST_ASSERT_NOT_NULL(state);
+    TEST_ASSERT_NOT_NULL(strstr(state, expected));
+}
+
+#if RELAY_EXP_BOARDS > 0
+static void test_card_channels(void)
+{
+    // Card 2 is the first expansion board, its channel 1 follows the main board
+    TEST_ASSERT_EQUAL_STRING("1", device_query("CLOSE (@2!1);*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", query_channel("CLOSE? (@%u)", RELAY_GPIO_COUNT + 1));
+
+    char command[48];
+    snprintf(command, sizeof(command), "CLOSE (@%u!%u);*OPC?", RELAY_CARD_COUNT, RELAY_EXP_CHANNELS);
+    TEST_ASSERT_EQUAL_STRING("1", device_query(command));
+    TEST_ASSERT_EQUAL_STRING("1", query_channel("CLOSE? (@%u)", RELAY_COUNT));
+}
+
+static void test_binary_keeps_channels_above_32(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", query_channel("CLOSE (@%u);*OPC?", RELAY_COUNT));
+
+    binctrl_request_t request = {.opcode = BINCTRL_OP_SET_BBM, .seq = 1, .mask = 1};
+    sim_usb_receive_ep(0x03, &request, sizeof(request));
+    device_run(50);
+
+    relay_mask_t expected = 1;
+    if (RELAY_COUNT > 32)
+        expected |= RELAY_BIT(RELAY_COUNT - 1);
+    TEST_ASSERT_EQUAL_STRING(mask_text(expected), device_query("GET?"));
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    device_start();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_channel_range);
+    RUN_TEST(test_set_full_width);
+    RUN_TEST(test_state_list);
+#if RELAY_EXP_BOARDS > 0
+    RUN_TEST(test_card_channels);
+    RUN_TEST(test_binary_keeps_channels_above_32);
+#endif
+    return UNITY_END();
+}
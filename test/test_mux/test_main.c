@@ -0,0 +1,161 @@
+// Exclusive mux groups: no relay output state may ever have two channels
+// of one group closed, including in the middle of make-before-break and
+// during scans.
+
+#include <unity.h>
+#include "../device.h"
+#include "binary_control.h"
+
+// Groups that had more than one channel closed, and output states seen
+// since the last reset
+static uint32_t g_shorted_groups;
+static relay_mask_t g_states[32];
+static uint32_t g_state_count;
+
+static void record_outputs(uint32_t tick, uint32_t odr)
+{
+    relay_mask_t state = (odr >> RELAY_PIN_SHIFT) & RELAY_GPIO_MASK;
+    for (int i = 0; i < MUX_GROUP_COUNT; i++)
+    {
+        relay_mask_t ch = state & mux_group_mask(i);
+        if (ch & (ch - 1))
+            g_shorted_groups |= 1 << i;
+    }
+    if (g_state_count < 32)
+        g_states[g_state_count++] = state;
+}
+
+static bool state_seen(relay_mask_t state)
+{
+    for (uint32_t i = 0; i < g_state_count; i++)
+    {
+        if (g_states[i] == state)
+            return true;
+    }
+    return false;
+}
+
+static void reset_record(void)
+{
+    g_shorted_groups = 0;
+    g_state_count = 0;
+}
+
+void setUp(void)
+{
+    device_query("ABORT;:TRIG:SOUR IMM;:MUX:EXCL OFF;:OPEN:ALL;*CLS;*OPC?");
+    device_flush();
+    reset_record();
+}
+
+void tearDown(void)
+{
+}
+
+static void test_mbb_within_group_breaks_first(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("MUX:EXCL ON;:CLOSE (@1);*OPC?"));
+    reset_record();
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("SET:MBB 2;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("2", device_query("GET?"));
+    TEST_ASSERT_EQUAL_UINT32(0, g_shorted_groups);
+}
+
+static void test_mbb_between_groups_overlaps(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("MUX:EXCL ON;:CLOSE (@1,5);*OPC?"));
+    reset_record();
+
+    // Group 1 moves from channel 1 to 2, channel 5 is only opened after
+    // channel 2 has closed
+    TEST_ASSERT_EQUAL_STRING("1", device_query("SET:MBB 2;*OPC?"));
+    TEST_ASSERT_EQUAL_UINT32(0, g_shorted_groups);
+    TEST_ASSERT_TRUE(state_seen(0x12));
+}
+
+static void test_commit_mbb_breaks_first(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("MUX:EXCL ON;:CLOSE (@3,6);*OPC?"));
+    reset_record();
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("BEGIN;:OPEN (@3,6);:CLOSE (@4,7);:COMMIT:MBB;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("72", device_query("GET?"));
+    TEST_ASSERT_EQUAL_UINT32(0, g_shorted_groups);
+}
+
+static void test_binary_mbb_breaks_first(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("MUX:EXCL ON;:CLOSE (@1);*OPC?"));
+    reset_record();
+
+    binctrl_request_t request = {.opcode = BINCTRL_OP_SET_MBB, .seq = 1, .mask = 4};
+    sim_usb_receive_ep(0x03, &request, sizeof(request));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("4", device_query("GET?"));
+    TEST_ASSERT_EQUAL_UINT32(0, g_shorted_groups);
+}
+
+static void test_mbb_without_exclusive_mode(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("CLOSE (@1);*OPC?"));
+    reset_record();
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("SET:MBB 2;*OPC?"));
+    TEST_ASSERT_EQUAL_UINT32(1, g_shorted_groups);
+}
+
+static void test_init_rejects_conflicting_scan(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("MUX:EXCL ON;:CLOSE (@1);:SCAN (@5,2);*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("-221,\"Settings conflict\"", device_query("INIT"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("STAT:OPER:COND?"));
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("SCAN (@5,6);:INIT;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("GET?"));
+    TEST_ASSERT_EQUAL_UINT32(0, g_shorted_groups);
+}
+
+static void test_scan_stops_before_conflicting_step(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("MUX:EXCL ON;:SCAN (@5,2);:TRIG:SOUR BUS;:INIT;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*TRG;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("16", device_query("GET?"));
+
+    // Channel 1 is closed while the scan is on channel 5, the scan then
+    // must not close channel 2
+    TEST_ASSERT_EQUAL_STRING("1", device_query("CLOSE (@1);*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*TRG;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("STAT:OPER:COND?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("GET?"));
+    TEST_ASSERT_EQUAL_UINT32(0, g_shorted_groups);
+}
+
+static void test_rst_discards_transaction(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("CLOSE (@1);:BEGIN;:CLOSE (@5);*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*RST;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("BEGIN?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("GET?"));
+
+    // A later COMMIT has nothing to apply
+    TEST_ASSERT_EQUAL_STRING("-200,\"Execution error\"", device_query("COMMIT"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("GET?"));
+}
+
+int main(int argc, char **argv)
+{
+    device_start();
+    sim_gpioa_hook = record_outputs;
+
+    UNITY_BEGIN();
+    RUN_TEST(test_mbb_within_group_breaks_first);
+    RUN_TEST(test_mbb_between_groups_overlaps);
+    RUN_TEST(test_commit_mbb_breaks_first);
+    RUN_TEST(test_binary_mbb_breaks_first);
+    RUN_TEST(test_mbb_without_exclusive_mode);
+    RUN_TEST(test_init_rejects_conflicting_scan);
+    RUN_TEST(test_scan_stops_before_conflicting_step);
+    RUN_TEST(test_rst_discards_transaction);
+    return UNITY_END();
+}
@@ -0,0 +1,129 @@
+// *SAV, *RCL and relay cycle counters with the flash log: values must
+// survive rotations of the log between its pages and a reload from flash
+// as after a power cycle.
+
+#include <unity.h>
+#include <stdio.h>
+#include "../device.h"
+
+// Header of a log page, see presets.c
+#define PAGE_MAGIC 0x5053
+
+static const uint16_t *page_header(uint32_t page)
+{
+    return (const uint16_t *)(uintptr_t)(PRESET_FLASH_ADDR + page * FLASH_PAGE_SIZE);
+}
+
+// Newest generation of a valid page header
+static uint16_t log_generation(void)
+{
+    uint16_t newest = 0;
+    for (uint32_t page = 0; page < PRESET_FLASH_PAGES; page++)
+    {
+        const uint16_t *header = page_header(page);
+        if (header[0] == PAGE_MAGIC && (int16_t)(header[1] - newest) > 0)
+            newest = header[1];
+    }
+    return newest;
+}
+
+static void assert_recall(uint32_t slot, uint32_t expected)
+{
+    char command[32], state[16];
+    snprintf(command, sizeof(command), "MEM:STAT:VAL? %u", (unsigned)slot);
+    TEST_ASSERT_EQUAL_STRING("1", device_query(command));
+
+    snprintf(command, sizeof(command), "*RCL %u;*OPC?", (unsigned)slot);
+    snprintf(state, sizeof(state), "%u", (unsigned)expected);
+    TEST_ASSERT_EQUAL_STRING("1", device_query(command));
+    TEST_ASSERT_EQUAL_STRING(state, device_query("GET?"));
+}
+
+void setUp(void)
+{
+    device_query("OPEN:ALL;:MEM:STAT:REC:AUTO OFF;*CLS;*OPC?");
+    device_flush();
+}
+
+void tearDown(void)
+{
+}
+
+static void test_unsaved_slot(void)
+{
+    TEST_ASSERT_EQUAL_STRING("0", device_query("MEM:STAT:VAL? 7"));
+}
+
+static void test_save_recall_across_rotations(void)
+{
+    uint32_t expected[PRESET_COUNT] = {0};
+    uint16_t start = log_generation();
+
+    // Enough saves to fill the log pages several times
+    for (uint32_t i = 0; i < 500; i++)
+    {
+        char command[48];
+        uint32_t slot = 1 + i % (PRESET_COUNT - 1);
+        uint32_t state = (i * 37 + 1) & 0xFF;
+        snprintf(command, sizeof(command), "SET %u;*SAV %u;*OPC?", (unsigned)state, (unsigned)slot);
+        TEST_ASSERT_EQUAL_STRING("1", device_query(command));
+        expected[slot] = state;
+    }
+    device_run(10);
+
+    TEST_ASSERT_GREATER_OR_EQUAL(3, (uint16_t)(log_generation() - start));
+
+    for (uint32_t slot = 1; slot < PRESET_COUNT; slot++)
+        assert_recall(slot, expected[slot]);
+
+    // Reload from flash as after a power cycle
+    relay_mask_t power_on_state;
+    presets_init(&power_on_state);
+
+    for (uint32_t slot = 1; slot < PRESET_COUNT; slot++)
+        assert_recall(slot, expected[slot]);
+}
+
+static void test_power_on_state(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("SET 66;*SAV 0;:MEM:STAT:REC:AUTO ON;*OPC?"));
+    device_run(10);
+
+    relay_mask_t power_on_state = 0;
+    TEST_ASSERT_TRUE(presets_init(&power_on_state));
+    TEST_ASSERT_EQUAL_UINT32(66, power_on_state);
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("MEM:STAT:REC:AUTO OFF;*OPC?"));
+    device_run(10);
+    TEST_ASSERT_FALSE(presets_init(&power_on_state));
+}
+
+static void test_cycles_saved_after_threshold(void)
+{
+    char before[16];
+    for (uint32_t i = 0; i < PRESET_CYCLES_THRESHOLD; i++)
+    {
+        TEST_ASSERT_EQUAL_STRING("1", device_query("CLOSE (@3);*OPC?"));
+        TEST_ASSERT_EQUAL_STRING("1", device_query("OPEN (@3);*OPC?"));
+    }
+    strcpy(before, device_query("DIAG:REL:CYCL? (@3)"));
+
+    // Many operations are written after the shorter interval, not after an hour
+    device_run(PRESET_CYCLES_MIN_INTERVAL_MS);
+
+    relay_mask_t power_on_state;
+    presets_init(&power_on_state);
+    TEST_ASSERT_EQUAL_STRING(before, device_query("DIAG:REL:CYCL? (@3)"));
+}
+
+int main(int argc, char **argv)
+{
+    device_start();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_unsaved_slot);
+    RUN_TEST(test_save_recall_across_rotations);
+    RUN_TEST(test_power_on_state);
+    RUN_TEST(test_cycles_saved_after_threshold);
+    return UNITY_END();
+}
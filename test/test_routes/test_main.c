@@ -0,0 +1,56 @@
+// Named routes and their catalog. CATalog? must answer even without
+// routes, otherwise a host waiting for its reply would time out.
+
+#include <unity.h>
+#include "../device.h"
+
+void setUp(void)
+{
+    device_query("OPEN:ALL;*CLS;*OPC?");
+    device_flush();
+}
+
+void tearDown(void)
+{
+}
+
+static void test_empty_catalog(void)
+{
+    TEST_ASSERT_EQUAL_STRING("\"\"", device_query("ROUT:CAT?"));
+
+    // Like a host library transaction with its terminating query
+    TEST_ASSERT_EQUAL_STRING("\"\";1", device_query("CAT?;*OPC?"));
+}
+
+static void test_define_and_delete(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("DEFINE DMMA,(@1,6);:DEFINE src_2,(@2),FLASH;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("DMMA,SRC_2", device_query("CAT?"));
+    TEST_ASSERT_EQUAL_STRING("#16(@1,6)", device_query("DEFINE? DMMA"));
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("CLOSE DMMA;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("33", device_query("GET?"));
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("DELETE DMMA;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("SRC_2", device_query("CAT?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("DELETE SRC_2;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("\"\"", device_query("CAT?"));
+}
+
+static void test_invalid_names(void)
+{
+    TEST_ASSERT_EQUAL_STRING("-224,\"Illegal parameter value\"", device_query("DELETE NONE"));
+    TEST_ASSERT_EQUAL_STRING("-224,\"Illegal parameter value\"", device_query("DEFINE 1BAD,(@1)"));
+    TEST_ASSERT_EQUAL_STRING("\"\"", device_query("CAT?"));
+}
+
+int main(int argc, char **argv)
+{
+    device_start();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_catalog);
+    RUN_TEST(test_define_and_delete);
+    RUN_TEST(test_invalid_names);
+    return UNITY_END();
+}
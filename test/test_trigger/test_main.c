@@ -0,0 +1,102 @@
+// *OPC? and *WAI together with scans that wait for BUS or EXTernal triggers.
+// A scan waiting for its trigger must not count as a pending operation,
+// otherwise *OPC? would wait for a *TRG that can only follow it.
+
+#include <unity.h>
+#include "../device.h"
+
+void setUp(void)
+{
+    device_query("ABORT;:TRIG:SOUR IMM;COUN 1;:SCAN (@1,2,3);:OPEN:ALL;*CLS;*OPC?");
+    device_flush();
+}
+
+void tearDown(void)
+{
+}
+
+static void test_opc_returns_while_waiting_for_bus_trigger(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("TRIG:SOUR BUS;:INIT;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("40", device_query("STAT:OPER:COND?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("GET?"));
+}
+
+static void test_bus_triggers_step_through_scan(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("TRIG:SOUR BUS;:INIT;*OPC?"));
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*TRG;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("GET?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*TRG;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("2", device_query("GET?"));
+
+    // Last step does not wait, *OPC? covers the end of the scan
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*TRG;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("GET?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("STAT:OPER:COND?"));
+}
+
+static void test_wai_returns_while_waiting_for_trigger(void)
+{
+    TEST_ASSERT_EQUAL_STRING("0", device_query("TRIG:SOUR BUS;:INIT;*WAI;:GET?"));
+}
+
+static void test_opc_returns_while_waiting_for_external_trigger(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("TRIG:SOUR EXT;:INIT;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("40", device_query("STAT:OPER:COND?"));
+}
+
+static void test_switch_to_immediate_resumes_scan(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("TRIG:SOUR BUS;:INIT;*OPC?"));
+
+    // Scan runs to its end without triggers, and is no longer reported
+    // as waiting for one
+    TEST_ASSERT_EQUAL_STRING("1", device_query("TRIG:SOUR IMM;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("STAT:OPER:COND?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("GET?"));
+}
+
+static void test_relay_command_while_waiting(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("TRIG:SOUR BUS;:INIT;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("CLOSE (@8);*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("40", device_query("STAT:OPER:COND?"));
+    TEST_ASSERT_EQUAL_STRING("128", device_query("GET?"));
+}
+
+static void test_abort_clears_waiting(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("TRIG:SOUR BUS;:INIT;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("ABORT;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("STAT:OPER:COND?"));
+}
+
+static void test_rst_stops_scan(void)
+{
+    TEST_ASSERT_EQUAL_STRING("1", device_query("TRIG:SOUR BUS;:INIT;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*TRG;:CLOSE (@8);*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("129", device_query("GET?"));
+
+    TEST_ASSERT_EQUAL_STRING("1", device_query("*RST;*OPC?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("STAT:OPER:COND?"));
+    TEST_ASSERT_EQUAL_STRING("0", device_query("GET?"));
+}
+
+int main(int argc, char **argv)
+{
+    device_start();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_opc_returns_while_waiting_for_bus_trigger);
+    RUN_TEST(test_bus_triggers_step_through_scan);
+    RUN_TEST(test_wai_returns_while_waiting_for_trigger);
+    RUN_TEST(test_opc_returns_while_waiting_for_external_trigger);
+    RUN_TEST(test_switch_to_immediate_resumes_scan);
+    RUN_TEST(test_relay_command_while_waiting);
+    RUN_TEST(test_abort_clears_waiting);
+    RUN_TEST(test_rst_stops_scan);
+    return UNITY_END();
+}